@@ -4,6 +4,7 @@
 
 #include <cxx/icxxabi.h>
 #include <sbi/sbi.h>
+#include <arch/timer.h>
 
 #include <mm/allocator.h>
 
@@ -92,6 +93,7 @@ void cpu::halt() {
 void cpu::boot_hart() {
     kvminithart();  // turn on paging
     trap_init_hart();
+    timer::probe_sstc(); // needs the trap vector
     plic_init_hart();  // ask PLIC for device interrupts
     booted = true;
 }
@@ -105,6 +107,16 @@ void cpu::sample(uint64 all, uint64 busy) {
     next_slot = (next_slot + 1) % SAMPLE_SLOT_COUNT;
 }
 
+uint64 cpu::busy_permille() {
+    uint64 all = 0;
+    uint64 busy = 0;
+    for (int i = 0; i < SAMPLE_SLOT_COUNT; i++) {
+        all += sample_duration[i];
+        busy += busy_time[i];
+    }
+    return all ? busy * 1000 / all : 0;
+}
+
 static void __function_caller(std::function<void()>* func_ptr) {
     kernel_assert(!cpu::local_irq_on(), "local_irq should be disabled");
     func_ptr->operator()();
@@ -138,6 +150,9 @@ void cpu::switch_back(context* current) {
     // saved_context.print();
     swtch(current, &saved_context);  // will goto scheduler()
 
+    // we may be resumed by a direct switch from another process
+    kernel_process_scheduler[current_id()].finish_switch();
+
     // debug_core("switch_back: back");
     // current->print();
 }
@@ -191,20 +206,6 @@ void cpu::backtrace_coroutine() {
     print_backtrace();
 }
 
-void cpu::__push_sleeper(uint64 wakeup_time, sleepable* sleeper) {
-
-    auto insert_pos = sleepers.end();
-    for (auto it = sleepers.begin(); it != sleepers.end(); ++it) {
-        if (wakeup_time < it->wakeup_time) {
-            insert_pos = it;
-            break;
-        }
-    }
-
-    
-    sleepers.insert_before(insert_pos, {wakeup_time, sleeper});
-}
-
 void cpu::sleep(wait_queue_base* wq, spinlock& lock) {
     kernel_assert(!cpu::local_irq_on(), "local_irq should be disabled");
     kernel_assert(current_process, "current_process should not be null");
@@ -212,30 +213,53 @@ void cpu::sleep(wait_queue_base* wq, spinlock& lock) {
     
 }
 
-void cpu::sleep(uint64 ticks, sleepable* sleeper) {
+void cpu::sleep(uint64 ticks, timer_wheel::node* n) {
     kernel_assert(!cpu::local_irq_on(), "local_irq should be disabled");
     kernel_assert(current_process, "current_process should not be null");
-    __push_sleeper(r_time() + ticks, sleeper);
+    sleepers.add(n, r_time() + ticks);
 }
 
 void cpu::sleep(uint64 ticks) {
     kernel_assert(!cpu::local_irq_on(), "local_irq should be disabled");
     kernel_assert(current_process, "current_process should not be null");
-    __push_sleeper(r_time() + ticks, current_process);
+
+    // the node is on our kernel stack, which stays until we return
+    timer_wheel::node n;
+    n.sleeper = current_process;
+    sleepers.add(&n, r_time() + ticks);
 
     current_process->sleep();
     yield();
+
+    timer_wheel::cancel(&n);
 }
 
 void cpu::wake_up() {
-    uint64 now = r_time();
-    while (!sleepers.empty()) {
-        auto& sleeper = sleepers.front();
-        if (sleeper.wakeup_time > now) {
-            break;
-        }
-        sleeper.sleeper->wake_up();
-        sleepers.pop_front();
+    sleepers.advance(r_time());
+}
+
+void cpu::start_slice(bool endless) {
+    __atomic_store_n(&slice_end, endless ? ~0ul : r_time() + timer::TIME_SLICE, __ATOMIC_RELAXED);
+}
+
+void cpu::end_slice() {
+    __atomic_store_n(&slice_end, 0, __ATOMIC_RELAXED);
+}
+
+bool cpu::slice_expired() {
+    return r_time() >= __atomic_load_n(&slice_end, __ATOMIC_RELAXED);
+}
+
+void cpu::program_timer(bool idle) {
+    uint64 deadline = sleepers.next_expiry();
+    uint64 end = __atomic_load_n(&slice_end, __ATOMIC_RELAXED);
+    if (!idle && end < deadline) {
+        deadline = end;
+    }
+
+    // an ecall is expensive, skip it if the timer is still armed for the same deadline
+    if (deadline != armed_deadline || deadline <= r_time()) {
+        timer::set_deadline(deadline);
+        armed_deadline = deadline;
     }
-    
 }
\ No newline at end of file
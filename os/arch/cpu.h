@@ -14,6 +14,7 @@
 #include <utils/utility.h>
 #include <utils/list.h>
 #include <utils/sleepable.h>
+#include <utils/timer_wheel.h>
 
 #include <atomic/spinlock.h>
 
@@ -63,11 +64,6 @@ extern "C" void swtch(context *, context *);
 
 class cpu_ref;
 
-struct sleep_info {
-    uint64 wakeup_time;
-    sleepable* sleeper;
-};
-
 // Per-CPU state.
 class cpu {
     process* current_process = nullptr;         // The process running on this cpu, or null.
@@ -75,7 +71,9 @@ class cpu {
     int core_id;
     uint8* temp_kstack;
 
-    list<sleep_info> sleepers;
+    timer_wheel sleepers;
+    uint64 slice_end = 0;       // preemption deadline of the running process
+    uint64 armed_deadline = 0;  // what the timer is set to
 
 
     uint64 sample_duration[SAMPLE_SLOT_COUNT] {};
@@ -105,6 +103,16 @@ class cpu {
         return booted;
     }
 
+    // dedicated to the coroutine executor by the boot option executor_cores=,
+    // no process is placed here and the executor is never preempted
+    bool is_executor_only(){
+        return executor_only;
+    }
+
+    void set_executor_only(){
+        executor_only = true;
+    }
+
     void plic_init_hart() {
         // set uart's enable bit for this hart's S-mode.
         *(uint32 *)PLIC_SENABLE(core_id) = (1 << VIRTIO0_IRQ);
@@ -180,8 +188,18 @@ class cpu {
 
     void sleep(wait_queue_base* wq, spinlock& lock);
     void sleep(uint64 ticks);
-    void sleep(uint64 ticks, sleepable* sleeper);
-    void wake_up(); // call by scheduler
+    // n lives in the sleeper, cancel it with timer_wheel::cancel if woken otherwise
+    void sleep(uint64 ticks, timer_wheel::node* n);
+    void wake_up(); // call by scheduler and timer interrupt
+
+    // the timer is tickless, it is set to the earliest of the next sleeper and
+    // the end of the time slice. an idle core only waits for sleepers.
+    // an endless slice is never preempted, end_slice (maybe from another
+    // core) cuts the current one short
+    void start_slice(bool endless = false);
+    void end_slice();
+    bool slice_expired();
+    void program_timer(bool idle = false);
     void yield();
     void switch_back(context* c);
     void save_context_and_run(std::function<void()> func);
@@ -192,6 +210,8 @@ class cpu {
     }
 
     void sample(uint64 all, uint64 busy);
+    // busy time over the sampled window, in 1/1000
+    uint64 busy_permille();
 
     
     // set halted of this core to True
@@ -241,7 +261,7 @@ class cpu {
     private:
     volatile bool halted = false;
     volatile bool booted = false;
-    void __push_sleeper(uint64 wakeup_time, sleepable* sleeper);
+    bool executor_only = false;
 
 };
 
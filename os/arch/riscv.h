@@ -68,6 +68,7 @@ static inline void w_sstatus(uint64 x) {
 }
 
 // Supervisor Interrupt Pending
+#define SIP_SSIP (1L << 1) // software
 static inline uint64 r_sip() {
     uint64 x;
     asm volatile("csrr %0, sip"
@@ -246,6 +247,13 @@ static inline uint64 r_time() {
     return x;
 }
 
+// supervisor timer compare (Sstc), by number for older assemblers
+static inline void w_stimecmp(uint64 x) {
+    asm volatile("csrw 0x14d, %0"
+                 :
+                 : "r"(x));
+}
+
 // machine clock cycle counter
 static inline uint64 r_cycle() {
     uint64 x;
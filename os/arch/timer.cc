@@ -0,0 +1,32 @@
+#include "timer.h"
+
+#include <device/fdt.h>
+
+extern "C" char __sstc_probe[];
+
+void timer::detect_sstc(const void* fdt) {
+    sstc = fdt_cpus_have_extension(fdt, "sstc");
+}
+
+// menvcfg.STCE is set by the firmware, without it stimecmp traps
+__attribute__((noinline)) void timer::probe_sstc() {
+    if (!sstc) {
+        return;
+    }
+    uint64 x;
+    asm volatile(".globl __sstc_probe\n"
+                 "__sstc_probe:\n"
+                 "csrr %0, 0x14d"
+                 : "=r"(x)
+                 :
+                 : "memory");
+    (void)x;
+}
+
+bool timer::fixup_probe(uint64 sepc) {
+    if (sepc != (uint64)__sstc_probe) {
+        return false;
+    }
+    sstc = false;
+    return true;
+}
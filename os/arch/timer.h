@@ -27,16 +27,31 @@ public:
     constexpr static uint64 SECOND_TO_CYCLE(uint64 sec) { return (sec)*CYCLE_FREQ; }
 
 
-    /// Set the next timer interrupt (10 ms)
-    static void set_next_timer() {
-        // 100Hz @ QEMU
-        const uint64 timebase = TICK_FREQ / TIME_SLICE_PER_SEC; // how many ticks
-        set_timer(r_time() + timebase);
+    constexpr static uint64 TIME_SLICE = TICK_FREQ / TIME_SLICE_PER_SEC; // ticks
+
+    /// arm the timer, write stimecmp directly with Sstc, otherwise ask sbi
+    static void set_deadline(uint64 deadline) {
+        if (sstc) {
+            w_stimecmp(deadline);
+        } else {
+            set_timer(deadline);
+        }
     }
 
+    /// look for Sstc in the device tree, on the boot hart
+    static void detect_sstc(const void* fdt);
+    /// on each hart, fall back to sbi if the firmware did not enable stimecmp
+    static void probe_sstc();
+    /// called on an illegal instruction in kernel, true if it is the probe
+    static bool fixup_probe(uint64 sepc);
+
+    static bool has_sstc() {
+        return sstc;
+    }
+
+    /// the deadline is programmed by cpu::program_timer
     static void start_timer_interrupt(){
         w_sie(r_sie() | SIE_STIE);
-        set_next_timer();
     }
 
     static void stop_timer_interrupt(){
@@ -52,6 +67,9 @@ public:
         return r_time() * USEC_PER_SEC / TICK_FREQ;
     }
 
+private:
+    static inline bool sstc = false;
+
 };
 
 
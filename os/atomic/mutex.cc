@@ -2,24 +2,99 @@
 #include <arch/riscv.h>
 #include <proc/process.h>
 #include <ccore/types.h>
+#include <task_scheduler.h>
 
 #include <utils/assert.h>
 
-task<void> coro_mutex::lock() {
-    _guard_lock.lock();
-    while (_locked) {
-        co_await _wait_queue.done(_guard_lock);
+std::coroutine_handle<> coro_mutex::lock_awaiter::await_suspend(task_base h) {
+    caller = std::move(h);
+
+    auto guard = make_lock_guard(m->_guard_lock);
+
+    if (caller.get_promise()->no_yield) {
+        // we cannot suspend, wait for it here
+        while (m->_locked) {
+            m->_guard_lock.unlock();
+            while (__atomic_load_n(&m->_locked, __ATOMIC_RELAXED)) {
+            }
+            m->_guard_lock.lock();
+        }
+        m->_locked = true;
+        m->__set_owner();
+        return caller.get_handle();
+    }
+
+    if (!m->_locked) { // released since we spun
+        m->_locked = true;
+        m->__set_owner();
+        return caller.get_handle();
+    }
+
+    next = nullptr;
+    if (m->_tail) {
+        m->_tail->next = this;
+    } else {
+        m->_head = this;
+    }
+    m->_tail = this;
+    caller.sleep();
+
+    // switch back to scheduler
+    return std::noop_coroutine();
+}
+
+bool coro_mutex::try_lock() {
+    auto guard = make_lock_guard(_guard_lock);
+    if (_locked) {
+        return false;
     }
     _locked = true;
-    _guard_lock.unlock();
-    co_return task_ok;
+    __set_owner();
+    return true;
 }
 
 void coro_mutex::unlock() {
-    _guard_lock.lock();
-    _locked = false;
-    _wait_queue.wake_up_one();
-    _guard_lock.unlock();
+    auto guard = make_lock_guard(_guard_lock);
+    lock_awaiter* w = _head;
+    if (!w) {
+        __atomic_store_n(&_locked, false, __ATOMIC_RELEASE);
+        return;
+    }
+
+    // hand it over, _locked stays set
+    _head = w->next;
+    if (!_head) {
+        _tail = nullptr;
+    }
+    __atomic_store_n(&_owner_core, -1, __ATOMIC_RELAXED); // not running until scheduled
+    w->handed_over = true;
+    // w is in the frame of the waiter, do not touch it after wake up
+    w->caller.wake_up();
 }
 
+bool coro_mutex::__spin_lock() {
+    for (uint32 i = 0; ; i++) {
+        if (!__atomic_load_n(&_locked, __ATOMIC_RELAXED) && try_lock()) {
+            return true;
+        }
+        if (i >= SPIN_LIMIT || !__holder_running()) {
+            return false;
+        }
+    }
+}
 
+// the holder runs on another core if that core has not returned from the
+// resume it took the mutex in
+bool coro_mutex::__holder_running() {
+    int core = __atomic_load_n(&_owner_core, __ATOMIC_RELAXED);
+    if (core < 0 || core == (int)r_tp()) {
+        return false;
+    }
+    return kernel_task_scheduler[core].get_resume_seq() == __atomic_load_n(&_owner_seq, __ATOMIC_RELAXED);
+}
+
+void coro_mutex::__set_owner() {
+    int core = r_tp();
+    __atomic_store_n(&_owner_seq, kernel_task_scheduler[core].get_resume_seq(), __ATOMIC_RELAXED);
+    __atomic_store_n(&_owner_core, core, __ATOMIC_RELAXED);
+}
@@ -3,22 +3,59 @@
 
 #include "spinlock.h"
 
-#include <utils/wait_queue.h>
 #include <coroutine.h>
 
-// this may cause hungry
+// fair: waiters queue in fifo order and unlock hands the mutex straight to
+// the first one, nobody can take it in between.
+// co_await lock() allocates nothing, the waiter lives in the awaiter. when
+// the holder is running on another core we spin a little before suspending,
+// critical sections are short and a suspend costs a trip to the scheduler.
 class coro_mutex {
 
     public:
+    static constexpr uint32 SPIN_LIMIT = 128;
+
     coro_mutex(const char* name = "unnamed") : _guard_lock(name) {}
 
-    task<void> lock();
+    struct lock_awaiter {
+        coro_mutex* m;
+        task_base caller;
+        lock_awaiter* next = nullptr;
+        bool handed_over = false;
+
+        lock_awaiter(coro_mutex* m) : m(m) {}
+        bool await_ready() {
+            return m->__spin_lock();
+        }
+        std::coroutine_handle<> await_suspend(task_base h);
+        void await_resume() {
+            if (handed_over) {
+                m->__set_owner();
+            }
+        }
+    };
+
+    // co_await it, the mutex is ours when it returns
+    lock_awaiter lock() {
+        return {this};
+    }
+    // return false if someone holds it, never suspends
+    bool try_lock();
     void unlock();
 
     private:
+    // take it if free, spin while the holder is running elsewhere
+    bool __spin_lock();
+    bool __holder_running();
+    // record where the holder runs, with _locked set by us
+    void __set_owner();
+
     bool _locked = false;
+    int _owner_core = -1;   // where the holder took it, -1 if unknown
+    uint64 _owner_seq = 0;  // resume_seq of that core then
     spinlock _guard_lock;
-    wait_queue _wait_queue;
+    lock_awaiter* _head = nullptr;
+    lock_awaiter* _tail = nullptr;
 
 };
 
@@ -3,8 +3,13 @@
 #include <utils/assert.h>
 
 #include <arch/cpu.h>
+#include <mm/frame_pool.h>
+#include <mm/frame_arena.h>
+#include <sbi/sbi.h>
+#include <arch/timer.h>
 
 #include <task_scheduler.h>
+#include <proc/scheduler.h>
 
 task_queue kernel_task_queue;
 task_scheduler kernel_task_scheduler[NCPU];
@@ -14,6 +19,10 @@ promise_base::~promise_base() {
         warnf("promise_base::~promise_base: promise never ran");
         panic("for debug");
     }
+    task_trace(_status == fail ? task_event::fail : task_event::complete, this);
+    if (owns_arena) {
+        arena->put();
+    }
 }
 
 task_base::task_base(task_base&& t)
@@ -42,34 +51,63 @@ void task_base::resume() {
     get_handle().resume();
 }
 
-// task executor destruct ifself after execution
-task<void> __task_executor(promise<void>* p) {
-
-    // __printf("task executor: %p\n", p);
-    p->has_error_handler = true;
-    
-    task<void> t{p}; // got the ownership
+void task_base::set_priority(task_priority p) {
+    if (_promise) {
+        _promise->priority = p;
+    }
+}
 
-    co_await t;
+void task_base::use_frame_arena() {
+    if (!_promise || _promise->arena) {
+        return;
+    }
+    _promise->arena = kernel_frame_arenas.acquire();
+    _promise->owns_arena = _promise->arena != nullptr;
+}
 
-    if (p->get_status() == promise_base::fail) {
-        // co_warnf("task_executor failed");
-        warnf("task_executor failed");
-    } 
-    co_return task_ok;
+void task_base::wake_up_critical() {
+    if (_promise->priority != task_priority::critical) {
+        _promise->boosted_from = _promise->priority;
+        _promise->boosted = true;
+        _promise->priority = task_priority::critical;
+    }
+    wake_up();
 }
 
 void task_base::wake_up(){
+    task_trace(task_event::wake, _promise);
+    _promise->wake_time = r_time();
     if(_promise->self_scheduler){
-        _promise->self_scheduler->__schedule(get_ref());
+        _promise->self_scheduler->__schedule(get_ref(), true);
     } else {
         kernel_task_queue.push(get_ref());
+        task_scheduler::wake_any();
     }
     
 }
 
 
 
+void* promise_base::operator new(std::size_t size) noexcept {
+    frame_arena* arena = frame_arena::current();
+    if (arena) {
+        void* ptr = arena->alloc(size);
+        if (ptr) {
+            return ptr;
+        }
+    }
+    return kernel_frame_pool.alloc(size);
+}
+
+void promise_base::operator delete(void* ptr, std::size_t size) noexcept {
+    frame_arena* arena = kernel_frame_arenas.owner_of(ptr);
+    if (arena) {
+        arena->free(ptr);
+        return;
+    }
+    kernel_frame_pool.free(ptr, size);
+}
+
 #ifdef HANDLE_MEMORY_ALLOC_FAIL
 
 task_fail_t promise_base::get_return_object_on_allocation_failure() {
@@ -95,49 +133,532 @@ void promise_base::backtrace() {
 
 }
 
-task_base task_queue::try_pop() {
-    auto guard = make_lock_guard(lock);
-
-    if(queue.empty()){
+// lock should be held
+task_base task_queue::__pop() {
+    auto& critical = queue[(int)task_priority::critical];
+    auto& normal = queue[(int)task_priority::normal];
+    auto& background = queue[(int)task_priority::background];
+
+    std::deque<task_base>* q;
+    if (!critical.empty()) {
+        q = &critical;
+    } else if (!normal.empty() && (background.empty() || ++pop_count % BACKGROUND_WEIGHT != 0)) {
+        q = &normal;
+    } else if (!background.empty()) {
+        q = &background;
+    } else {
         // debug_core("task_queue is empty");
         return {};
     }
 
-    task_base ret = std::move(queue.front());
-    queue.pop_front();
-
+    task_base ret = std::move(q->front());
+    q->pop_front();
+    stats.pops++;
 
     return ret;
 }
 
+task_base task_queue::try_pop() {
+    auto guard = make_lock_guard(lock);
+    return __pop();
+}
+
 task_base task_queue::pop() {
     lock.lock();
 
-    while(queue.empty()){
+    while(empty()){
         // debugf("task_queue: sleep");
         cpu::my_cpu()->sleep(&wait_task_queue, lock);
     }
 
-    task_base ret = std::move(queue.front());
-    queue.pop_front();
+    task_base ret = __pop();
     lock.unlock();
 
     return ret;
 }
 
+uint32 task_queue::try_pop_batch(promise_base** batch, uint32 max) {
+    if (!max) {
+        return 0;
+    }
+    auto guard = make_lock_guard(lock);
+
+    uint32 n = std::min<uint32>(max, size() / NCPU + 1);
+
+    task_base t = __pop();
+    if (!t) {
+        return 0;
+    }
+    batch[0] = t.get_promise();
+
+    auto& normal = queue[(int)task_priority::normal];
+    uint32 i = 1;
+    for (; i < n && !normal.empty(); i++) {
+        batch[i] = normal.front().get_promise();
+        normal.pop_front();
+    }
+    stats.pops += i - 1;
+    return i;
+}
+
 void task_queue::push(task_base&& proc) {
     auto guard = make_lock_guard(lock);
-    queue.push_back(std::move(proc));
+    int prio = (int)proc.get_promise()->priority;
+    queue[prio].push_back(std::move(proc));
+    stats.pushes++;
+    stats.max_depth = std::max(stats.max_depth, (uint32)size());
     // debugf("task_queue: wake up all (%d)(%d)", queue.size(), wait_task_queue.size());
     
     // wait_task_queue.wake_up_one();
 
 }
 
-void task_scheduler::start() {
+void task_queue::push_batch(promise_base* const* batch, uint32 n) {
+    auto guard = make_lock_guard(lock);
+    for (uint32 i = 0; i < n; i++) {
+        queue[(int)batch[i]->priority].push_back(task_base{batch[i], false});
+    }
+    stats.pushes += n;
+    stats.max_depth = std::max(stats.max_depth, (uint32)size());
+}
 
+bool local_task_queue::push(promise_base* p) {
+    uint32 h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    uint32 t = tail;
+    if (t - h >= CAPACITY) {
+        return false;
+    }
+    slots[t % CAPACITY] = p;
+    __atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+promise_base* local_task_queue::pop() {
     while (true) {
+        uint32 h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+        uint32 t = tail;
+        if (t == h) {
+            return nullptr;
+        }
+        promise_base* p = slots[h % CAPACITY];
+        if (__atomic_compare_exchange_n(&head, &h, h + 1, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return p;
+        }
+        // a thief took it, retry
+    }
+}
+
+uint32 local_task_queue::pop_half(promise_base** batch) {
+    uint32 h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    uint32 t = tail;
+    uint32 n = (t - h) / 2;
+    for (uint32 i = 0; i < n; i++) {
+        batch[i] = slots[(h + i) % CAPACITY];
+    }
+    if (!__atomic_compare_exchange_n(&head, &h, h + n, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        // thieves made some room for us
+        return 0;
+    }
+    return n;
+}
+
+promise_base* local_task_queue::steal_from(local_task_queue& victim) {
+    uint32 t = tail;
+    uint32 room = CAPACITY - (t - __atomic_load_n(&head, __ATOMIC_ACQUIRE));
+    uint32 n;
+
+    while (true) {
+        uint32 h = __atomic_load_n(&victim.head, __ATOMIC_ACQUIRE);
+        uint32 vt = __atomic_load_n(&victim.tail, __ATOMIC_ACQUIRE);
+        n = vt - h;
+        n = n - n / 2;
+        if (n == 0) {
+            return nullptr;
+        }
+        if (n > CAPACITY / 2) {
+            // inconsistent head and tail, retry
+            continue;
+        }
+        n = std::min(n, room);
+        if (n == 0) {
+            return nullptr;
+        }
+        for (uint32 i = 0; i < n; i++) {
+            slots[(t + i) % CAPACITY] = victim.slots[(h + i) % CAPACITY];
+        }
+        if (__atomic_compare_exchange_n(&victim.head, &h, h + n, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    // run the last one directly, publish the others
+    n--;
+    promise_base* ret = slots[(t + n) % CAPACITY];
+    if (n) {
+        __atomic_store_n(&tail, t + n, __ATOMIC_RELEASE);
+    }
+    return ret;
+}
+
+void task_scheduler::__schedule(task_base&& h, bool wakeup) {
+    h.clear_owner();
+    task_base buf = std::move(h);
+    promise_base* p = buf.get_promise();
+    p->self_scheduler = this;
+
+    if (core_id >= 0) {
+        // irq off until we are done with the ring and run_next, interrupt
+        // handlers of this core wake tasks into them too
+        cpu_ref c = cpu::my_cpu();
+        if (c->get_core_id() == core_id) {
+            // we are the owner, no lock needed
+            if (wakeup && p->priority != task_priority::background) {
+                // its state is cache-hot, run it next and kick out the old one
+                p = __atomic_exchange_n(&run_next, p, __ATOMIC_ACQ_REL);
+                if (!p) {
+                    return;
+                }
+            }
+            // local queue only holds normal tasks
+            if (p->priority == task_priority::normal) {
+                if (!local_queue.push(p)) {
+                    __push_overflow(p);
+                }
+                // let idle cores steal it
+                wake_any();
+                return;
+            }
+            buf = task_base{p, false};
+        } else {
+            remote_queue.push(std::move(buf));
+            __sync_synchronize();
+            __wake_parked();
+            return;
+        }
+    } else {
+        _task_queue->push(std::move(buf));
+        wake_any();
+        return;
+    }
+
+    remote_queue.push(std::move(buf));
+    wake_any();
+}
+
+void task_scheduler::schedule_batch(task_base* tasks, uint32 n) {
+    promise_base* batch[SCHEDULE_BATCH];
+
+    // the owner moves them into its local queue in batches when it pops
+    task_queue* q = core_id >= 0 ? &remote_queue : _task_queue;
+
+    while (n) {
+        uint32 m = 0;
+        uint32 count = std::min(n, SCHEDULE_BATCH);
+        for (uint32 i = 0; i < count; i++) {
+            task_base& h = tasks[i];
+            if (!h) {
+                continue;
+            }
+            __detach_root(h);
+            h.clear_owner();
+            promise_base* p = h.get_promise();
+            p->self_scheduler = this;
+            batch[m++] = p;
+            h = task_base{};
+        }
+        tasks += count;
+        n -= count;
+
+        if (m) {
+            q->push_batch(batch, m);
+        }
+    }
+
+    __sync_synchronize();
+    if (core_id >= 0) {
+        __wake_parked();
+    }
+    wake_any();
+}
+
+executor_stats executor_stats::since(const executor_stats& prev) const {
+    executor_stats ret = *this;
+    ret.tasks_run -= prev.tasks_run;
+    ret.steals -= prev.steals;
+    ret.idle_rounds -= prev.idle_rounds;
+    ret.parks -= prev.parks;
+    ret.coop_yields -= prev.coop_yields;
+    ret.resume_cycles -= prev.resume_cycles;
+    ret.depth_sum -= prev.depth_sum;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        ret.wake_latency[i] -= prev.wake_latency[i];
+    }
+    return ret;
+}
+
+void executor_stats::print(int core_id) const {
+    rawf("core %d: run %l, steals %l, idle %l, parks %l, coop yields %l, resume %l us, depth avg %l max %d",
+         core_id, tasks_run, steals, idle_rounds, parks, coop_yields,
+         (int64)timer::CYCLE_TO_US(resume_cycles),
+         (int64)(tasks_run ? depth_sum / tasks_run : 0), depth_max);
+    _rawf("  wake latency (us, 2^i):");
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        _rawf(" %l", wake_latency[i]);
+    }
+    _rawf("\n");
+}
+
+void task_scheduler::sample_stats() {
+    last_second = stats.since(__prev_stats);
+    __prev_stats = stats;
+    // max depth is per window
+    stats.depth_max = 0;
+}
+
+void task_scheduler::print_stats() {
+    for (int i = 0; i < NCPU; i++) {
+        task_scheduler& s = kernel_task_scheduler[i];
+        if (s.core_id < 0) {
+            continue;
+        }
+        rawf("total:");
+        s.stats.print(i);
+        rawf("last second:");
+        s.last_second.print(i);
+    }
+    task_queue_stats q = kernel_task_queue.get_stats();
+    rawf("shared queue: pushes %l, pops %l, max depth %d", q.pushes, q.pops, q.max_depth);
+}
+
+// number of schedulers waiting in wfi, so that pushing needs no scan
+// when everyone is busy
+static uint32 parked_schedulers = 0;
+
+void task_scheduler::wake_any() {
+    __sync_synchronize();
+    if (!__atomic_load_n(&parked_schedulers, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    for (int i = 0; i < NCPU; i++) {
+        if (kernel_task_scheduler[i].__wake_parked()) {
+            return;
+        }
+    }
+}
+
+bool task_scheduler::__wake_parked() {
+    bool expected = true;
+    if (__atomic_compare_exchange_n(&parked, &expected, false, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        send_ipi(1ul << core_id);
+        return true;
+    }
+    return false;
+}
+
+// anything __steal would take, remote queues included: a push to a busy
+// core sends no ipi, so we look before we park
+bool task_scheduler::__has_stealable() {
+    for (int i = 0; i < NCPU; i++) {
+        task_scheduler& victim = kernel_task_scheduler[i];
+        if (victim.core_id < 0) {
+            continue;
+        }
+        if (!victim.local_queue.empty() || !victim.remote_queue.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// wait in wfi until someone pushes work for us (ipi) or the timer preempts us.
+// irq is off while we check, a pending interrupt still wakes up wfi,
+// so there is no lost wakeup
+void task_scheduler::__park() {
+    bool old = cpu::local_irq_save();
+
+    __atomic_store_n(&parked, true, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&parked_schedulers, 1, __ATOMIC_SEQ_CST);
+    __sync_synchronize();
+
+    if (is_free() && !__has_stealable()) {
+        stats.parks++;
+        // no ticks while parked, only sleepers wake us besides ipi.
+        // the slice goes on, if it ends meanwhile the timer fires right after
+        cpu::__my_cpu()->program_timer(true);
+        wfi();
+        cpu::__my_cpu()->program_timer();
+    }
+
+    __atomic_store_n(&parked, false, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(&parked_schedulers, 1, __ATOMIC_SEQ_CST);
+
+    // take the pending interrupt (ipi or timer) here
+    cpu::local_irq_restore(old);
+}
+
+// local queue is full, move half of it with p to the shared queue.
+// owner only, irq disabled (overflow_buffer is ours then)
+void task_scheduler::__push_overflow(promise_base* p) {
+    while (!local_queue.push(p)) {
+        uint32 n = local_queue.pop_half(overflow_buffer);
+        if (n) {
+            overflow_buffer[n++] = p;
+            _task_queue->push_batch(overflow_buffer, n);
+            wake_any();
+            return;
+        }
+    }
+}
+
+task_base task_scheduler::__steal() {
+    for (int i = 1; i < NCPU; i++) {
+        task_scheduler& victim = kernel_task_scheduler[(core_id + i) % NCPU];
+        if (victim.core_id < 0) {
+            continue;
+        }
+        // steal_from writes our ring, keep our interrupt handlers out of it
+        bool old = cpu::local_irq_save();
+        promise_base* p = local_queue.steal_from(victim.local_queue);
+        cpu::local_irq_restore(old);
+        if (p) {
+            stats.steals++;
+            return {p, false};
+        }
+        if (!victim.remote_queue.empty()) {
+            task_base t = __pop_batch(victim.remote_queue);
+            if (t) {
+                stats.steals++;
+                return t;
+            }
+        }
+    }
+    return {};
+}
+
+task_base task_scheduler::__take_run_next() {
+    promise_base* p = __atomic_exchange_n(&run_next, nullptr, __ATOMIC_ACQ_REL);
+    if (p) {
+        run_next_streak++;
+        return {p, false};
+    }
+    return {};
+}
+
+// take a batch from q in one lock acquisition, return the first one
+// and keep the others (normal tasks) in our local queue
+task_base task_scheduler::__pop_batch(task_queue& q) {
+    // on our stack, __push_overflow has overflow_buffer
+    promise_base* batch[POP_BATCH];
+
+    bool old = cpu::local_irq_save();
+    // irq is off and only we push to local queue, so the room would not shrink
+    uint32 room = local_task_queue::CAPACITY - local_queue.size();
+    uint32 n = q.try_pop_batch(batch, std::min(room + 1, POP_BATCH));
+    for (uint32 i = 1; i < n; i++) {
+        if (!local_queue.push(batch[i])) {
+            __push_overflow(batch[i]);
+        }
+    }
+    cpu::local_irq_restore(old);
+
+    if (!n) {
+        return {};
+    }
+    if (n > 2) {
+        wake_any();
+    }
+    return {batch[0], false};
+}
+
+// try remote queue, then shared queue
+task_base task_scheduler::__pop_shared() {
+    if (!remote_queue.empty()) {
+        task_base t = __pop_batch(remote_queue);
+        if (t) {
+            return t;
+        }
+    }
+
+    if (!_task_queue->empty()) {
+        task_base t = __pop_batch(*_task_queue);
+        if (t) {
+            return t;
+        }
+    }
+
+    return {};
+}
+
+task_base task_scheduler::__next_task() {
+    if (core_id < 0) {
+        return _task_queue->try_pop();
+    }
+
+    // check the shared queue once in a while, so it would not starve
+    // when our local queue is always busy
+    if (++schedule_tick % 61 == 0 && !_task_queue->empty()) {
         task_base t = _task_queue->try_pop();
+        if (t) {
+            return t;
+        }
+    }
+
+    // critical tasks first
+    if (remote_queue.has_critical() || _task_queue->has_critical()) {
+        task_base t = __pop_shared();
+        if (t) {
+            return t;
+        }
+    }
+
+    if (run_next_streak < RUN_NEXT_LIMIT) {
+        task_base t = __take_run_next();
+        if (t) {
+            return t;
+        }
+    }
+    run_next_streak = 0;
+
+    // give background tasks a chance
+    if (++local_pop_count % task_queue::BACKGROUND_WEIGHT == 0) {
+        task_base t = __pop_shared();
+        if (t) {
+            return t;
+        }
+    }
+
+    bool old = cpu::local_irq_save();
+    promise_base* p = local_queue.pop();
+    cpu::local_irq_restore(old);
+    if (p) {
+        return {p, false};
+    }
+
+    {
+        task_base t = __pop_shared();
+        if (t) {
+            return t;
+        }
+    }
+
+    // nothing else to run, ignore the limit
+    task_base t = __take_run_next();
+    if (t) {
+        return t;
+    }
+
+    // one that returns on idle runs its own tasks only (tests)
+    if (return_on_idle) {
+        return {};
+    }
+    return __steal();
+}
+
+void task_scheduler::start() {
+
+    uint32 idle_rounds = 0;
+    while (true) {
+        task_base t = __next_task();
         if (!t) {
             if (return_on_idle) {
                 return;
@@ -154,16 +675,59 @@ void task_scheduler::start() {
             //     t = _task_queue->pop();
             // }
 
-            cpu::my_cpu()->yield();
+            stats.idle_rounds++;
+
+            // we are the fallback of the process scheduler of our core,
+            // processes queued there (maybe with the ipi that woke us) go first
+            if (core_id >= 0 && kernel_process_queue.queue(core_id).runnable()) {
+                cpu::my_cpu()->yield();
+                continue;
+            }
+
+            // give other cores a chance to hand us processes first,
+            // then sleep in wfi instead of spinning on yield
+            if (core_id >= 0 && ++idle_rounds > PARK_AFTER_IDLE) {
+                __park();
+            } else {
+                cpu::my_cpu()->yield();
+            }
             continue;
         }
+        idle_rounds = 0;
         
 
         // debug_core("task_scheduler: try to switch to %p\n", t.get_promise());
         // printf("scheduler: task status: %d\n", t.get_promise()->get_status());
         kernel_assert(cpu::local_irq_on(), "task_scheduler: irq off");
+        // it may be stolen from others, so we wake it up here next time
+        t.get_promise()->self_scheduler = this;
         // all tasks we own, we start it here
+        promise_base* p = t.get_promise();
+        if (p->wake_time) {
+            stats.add_latency(timer::TICK_TO_US(r_time() - p->wake_time));
+            p->wake_time = 0;
+        }
+        stats.add_depth(local_queue.size());
+        stats.tasks_run++;
+        if (p->boosted) { // only this round is critical
+            p->priority = p->boosted_from;
+            p->boosted = false;
+        }
+
+        task_trace(task_event::resume, p);
+        coop_budget::refill();
+        frame_arena::set_current(p->arena);
+        #ifndef COROUTINE_TRACE
+        // for backtrace on panic, awaits do not track it in this mode
+        cpu::my_cpu()->set_promise(p);
+        #endif
+        uint64 resume_start = r_cycle();
         t.resume();
+        stats.resume_cycles += r_cycle() - resume_start;
+        __atomic_add_fetch(&resume_seq, 1, __ATOMIC_RELEASE);
+        frame_arena::set_current(nullptr);
+        // p may be gone here, we only record its address
+        task_trace(task_event::suspend, p);
 
         // debugf("task_scheduler: switch done");
         // we do not track the status of tasks
@@ -175,13 +739,20 @@ void task_scheduler::start() {
 std::coroutine_handle<> coroutine_handle_fail(task_base curr) {
     // if curr has error handler(its caller), we resume its caller
     // otherwise, we set curr = curr.caller and continue this process
-    // eventually we would encounter task whose caller is task_executor,
-    // which has no caller and set the task's have_error_handler to true
-    // so we will resume the task_executor. if not so, we panic
+    // eventually we would encounter the root task spawned by a scheduler,
+    // which is detached and destroys itself. if not so, we panic
     while (true) {
         promise_base* curr_promise = curr.get_promise();
         if (!curr_promise->caller){
             // top
+            if (curr_promise->detached) {
+                // spawned by scheduler, nobody waits for it,
+                // destroying it destroys the callees it owns
+                warnf("detached task %p failed", curr_promise);
+                curr_promise->set_fail();
+                curr.get_handle().destroy();
+                return std::noop_coroutine();
+            }
             panic("no error handler found");
         } else if (curr_promise->has_error_handler){
             // we set status of current task to fail,
@@ -250,4 +821,97 @@ task<return_type>::ret_opt_type task<return_type>::task_awaiter::await_resume()
     return std::move(p->result);
 }
 
-*/
\ No newline at end of file
+*/
+
+std::coroutine_handle<> __coop_yield(task_base t) {
+    promise_base* p = t.get_promise();
+    task_scheduler* s = p->self_scheduler;
+    if (!s || p->no_yield) {
+        return t.get_handle();
+    }
+    // s may belong to another core, stats are written by their own core only
+    kernel_task_scheduler[cpu::current_id()].stats.coop_yields++;
+    s->schedule(std::move(t));
+    return std::noop_coroutine();
+}
+
+void __spawn_child(promise_base* parent, task_base&& child) {
+    child.set_priority(parent->priority);
+    if (parent->self_scheduler) {
+        parent->self_scheduler->schedule(std::move(child));
+    } else {
+        push_task(child);
+    }
+}
+
+void __combinator_state_base::child_done(int32 index, bool ok) {
+    // exactly one child decides to resume the parent, and how
+    bool resume = false;
+    if (!ok) {
+        __atomic_store_n(&failed, true, __ATOMIC_RELEASE);
+    }
+
+    if (any) {
+        int32 expected = -1;
+        // claim it before we leave pending, so the last one sees it
+        bool won = ok && __atomic_compare_exchange_n(&first, &expected, index, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+        bool last = __atomic_sub_fetch(&pending, 1, __ATOMIC_ACQ_REL) == 0;
+        if (won) {
+            resume = true;
+        } else if (last && __atomic_load_n(&first, __ATOMIC_ACQUIRE) < 0) {
+            // all failed
+            resume_failed = true;
+            resume = true;
+        }
+    } else if (__atomic_sub_fetch(&pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        // the last one, all failures are visible after the decrement
+        resume_failed = __atomic_load_n(&failed, __ATOMIC_ACQUIRE);
+        resume = true;
+    }
+
+    if (resume) {
+        std::coroutine_handle<> h = open_gate();
+        if (h) {
+            task_base{h}.wake_up();
+        }
+    }
+
+    release();
+}
+
+std::coroutine_handle<> __combinator_state_base::open_gate() {
+    if (__atomic_sub_fetch(&gate, 1, __ATOMIC_ACQ_REL) != 0) {
+        return nullptr;
+    }
+    if (resume_failed) {
+        parent.get_promise()->set_fail();
+        std::coroutine_handle<> h = coroutine_handle_fail(parent.get_ref());
+        // a detached root is destroyed in place, there is nothing to resume
+        return h == std::noop_coroutine() ? nullptr : h;
+    }
+    return parent.get_handle();
+}
+
+void __combinator_state_base::release() {
+    if (__atomic_sub_fetch(&refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        delete this;
+    }
+}
+
+std::coroutine_handle<> __combinator_awaiter_base::await_suspend(task_base h) {
+    __combinator_state_base* s = state;
+    promise_base* p = h.get_promise();
+    s->parent = std::move(h);
+
+    for (uint32 i = 0; i < children.size(); i++) {
+        if (!children[i]) {
+            s->child_done(i, false);
+            continue;
+        }
+        __spawn_child(p, std::move(children[i]));
+    }
+
+    // children may have finished, the parent may be resumed by us
+    std::coroutine_handle<> next = s->open_gate();
+    return next ? next : std::noop_coroutine();
+}
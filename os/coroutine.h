@@ -4,6 +4,8 @@
 #include <coroutine>
 #include <optional>
 #include <queue>
+#include <tuple>
+#include <vector>
 
 // #include <mm/allocator.h>
 #include <ccore/types.h>
@@ -14,6 +16,7 @@
 
 #include <utils/sleepable.h>
 #include <utils/list.h>
+#include <utils/task_trace.h>
 
 #include <arch/config.h>
 #include <arch/cpu.h>
@@ -81,9 +84,19 @@ inline constexpr task_fail_t task_fail{task_fail_t::_Construct::_Token};
 
 struct promise_base;
 
+// priority class of a task, used when it is queued by task_scheduler
+enum class task_priority : uint8 {
+    critical = 0,   // latency critical, e.g. I/O completion
+    normal,
+    background,     // e.g. writeback
+};
+constexpr int TASK_PRIORITY_COUNT = 3;
+
 // task destruct the promise if it is the owner
 // task_base will never destruct promise
 // destruct function is defined in the derived class
+class frame_arena;
+
 struct task_base : noncopyable, sleepable {
     using promise_type = promise_base;
     // take the ownership of the coroutine
@@ -130,11 +143,18 @@ struct task_base : noncopyable, sleepable {
         _owner = false; 
     }
 
+    void set_priority(task_priority p);
+
+    // opt-in for a root task: frames of coroutines it awaits come from
+    // a bump arena it owns, falls back to heap if no arena is free
+    void use_frame_arena();
+
     void sleep() {
         // do nothing
     }
 
     void wake_up();
+    void wake_up_critical() override;
 
    protected:
     promise_type* _promise = nullptr;
@@ -161,6 +181,9 @@ struct promise_base {
     // where we schedule ourselves to
     task_scheduler* self_scheduler = nullptr;
 
+    // spawned by a scheduler with no caller, we destroy ourselves when done
+    bool detached = false;
+
     // if our caller can handle error, if so,
     // when we or our callee fail, we resume our caller
     bool has_error_handler = false;
@@ -168,11 +191,26 @@ struct promise_base {
     // do not pass control to scheduler
     bool no_yield = false;
 
+    // callee with normal priority takes the priority of its caller
+    task_priority priority = task_priority::normal;
+    // raised to critical by wake_up_critical, priority is restored to
+    // boosted_from when it runs
+    bool boosted = false;
+    task_priority boosted_from = task_priority::normal;
+
+    // r_time() of the last wake_up, for wake-to-run latency, 0 if not woken
+    uint64 wake_time = 0;
+
+    // frames of our callees come from here, inherited from caller like priority
+    frame_arena* arena = nullptr;
+    bool owns_arena = false;
+
     // track the ownership of the coroutine
     // task_base* owned_by = nullptr;
 
     status get_status() const { return _status; }
     void set_fail() { _status = fail; }
+    void set_init() { _status = init; }
     void set_running() { _status = running; }
     void set_await_address(void* addr) { await_address = addr; }
 
@@ -182,6 +220,10 @@ struct promise_base {
     static task_fail_t get_return_object_on_allocation_failure();
 #endif
 
+    // coroutine frames come from per-cpu pools, return nullptr on failure
+    static void* operator new(std::size_t size) noexcept;
+    static void operator delete(void* ptr, std::size_t size) noexcept;
+
    protected:
    friend class task_base;
 
@@ -189,6 +231,30 @@ struct promise_base {
 };
 
 std::coroutine_handle<> coroutine_handle_fail(task_base curr);
+
+// cooperative budget, like tokio coop: a scheduler refills it before each
+// resume and every await spends one. when it runs out, the awaiting side
+// goes back to its scheduler, so a task that keeps hitting ready awaits
+// cannot hold the executor until timer preemption
+struct coop_budget {
+    static constexpr uint32 BUDGET = 128;
+    static inline uint32 left[NCPU] {};
+
+    static void refill() { left[r_tp()] = BUDGET; }
+    // return false if exhausted
+    static bool spend() {
+        uint32& b = left[r_tp()];
+        if (!b) {
+            return false;
+        }
+        b--;
+        return true;
+    }
+};
+
+// put t back to its scheduler and return noop_coroutine,
+// or return t itself if it cannot yield
+std::coroutine_handle<> __coop_yield(task_base t);
 void coroutine_debug(const char*);
 
 
@@ -247,7 +313,10 @@ struct promise : public promise_base {
 
     // task<return_type> get_return_object() { return {this}; }
 
-    promise* get_return_object() { return this; }
+    promise* get_return_object() {
+        task_trace(task_event::create, this);
+        return this;
+    }
 
 
     template <std::convertible_to<return_type> from_t, typename T = return_type>
@@ -368,10 +437,14 @@ struct task : task_base {
             }
 
 
+            // per-await tracking is for debugging only, it toggles irq twice.
+            // otherwise the scheduler records the promise it resumes
+            #ifdef COROUTINE_TRACE
             {
                 auto cpu_ref = cpu::my_cpu();
                 last_promise = cpu_ref->set_promise(p);
             }
+            #endif
 
 
             if (!p->self_scheduler) {
@@ -383,11 +456,24 @@ struct task : task_base {
                 p->no_yield = caller_promise->no_yield;
             }
 
+            if (p->priority == task_priority::normal) {
+                p->priority = caller_promise->priority;
+            }
+
+            if (!p->arena) {
+                p->arena = caller_promise->arena;
+            }
+
             // we don't have the ownership of the caller
             p->caller = std::move(caller);
 
             p->set_running();
 
+            // out of budget, the callee starts from the scheduler queue
+            if (!coop_budget::spend()) {
+                return __coop_yield(task_base{p, false});
+            }
+
             // resume ourselves, by tail call optimization, we will not create a new
             // stack frame
             return task::get_handle(p);
@@ -403,10 +489,12 @@ struct task : task_base {
                 return {};
             }
 
+            #ifdef COROUTINE_TRACE
             {
                 auto cpu_ref = cpu::my_cpu();
                 cpu_ref->set_promise(last_promise);
             }
+            #endif
 
             return std::move(p->result);
         }
@@ -443,20 +531,420 @@ struct task : task_base {
     //}
 };
 
+// return type of functions whose result is often known without suspending,
+// e.g. a cache hit. it is either done already, then co_await neither
+// suspends nor allocates a frame, or it holds the task of the slow path
+template <typename return_type>
+struct ready_task : noncopyable {
+    using task_type = task<return_type>;
+    using ret_opt_type = typename task_type::ret_opt_type;
+
+    // slow path
+    ready_task(task_type&& t) : slow(std::move(t)) {}
+
+    // completed synchronously, pass true for void
+    static ready_task done(ret_opt_type&& result) {
+        return {std::move(result), true};
+    }
+
+    struct awaiter {
+        ready_task& self;
+        typename task_type::task_awaiter inner;
+
+        // a ready one still spends budget, we suspend only when it is exhausted
+        bool await_ready() { return self.ready && coop_budget::spend(); }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) {
+            if (self.ready) {
+                return __coop_yield(h);
+            }
+            return inner.await_suspend(h);
+        }
+        ret_opt_type await_resume() {
+            if (self.ready) {
+                return std::move(self.result);
+            }
+            return inner.await_resume();
+        }
+    };
+
+    awaiter operator co_await() noexcept {
+        return {*this, slow.operator co_await()};
+    }
+
+   private:
+    ready_task(ret_opt_type&& result, bool ready) : result(std::move(result)), ready(ready) {}
+
+    task_type slow;
+    ret_opt_type result {};
+    bool ready = false;
+};
+
+// generator that only moves control by symmetric transfer: co_yield hands
+// the consumer a pointer to the value in our frame (no copy), there is no
+// scheduler interaction and no cpu::set_promise on yield.
+// the body may co_await tasks, then consume it with co_await (nullptr at
+// the end or on failure). a body that never suspends on anything but
+// co_yield can also be iterated with a range for loop.
+template <typename T>
+struct generator : noncopyable {
+    struct promise_type : promise_base {
+        T* current = nullptr; // valid until we are resumed again
+        std::coroutine_handle<> consumer;
+
+        // we run lazily, being dropped before the first resume is fine
+        promise_type() { set_running(); }
+
+        generator get_return_object() {
+            task_trace(task_event::create, this);
+            return {this};
+        }
+
+        struct yield_awaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                return h.promise().consumer;
+            }
+            void await_resume() noexcept {}
+        };
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        yield_awaiter final_suspend() noexcept {
+            current = nullptr;
+            _status = done;
+            return {};
+        }
+        void unhandled_exception() {}
+        void return_void() {}
+
+        yield_awaiter yield_value(T& value) noexcept {
+            current = &value;
+            return {};
+        }
+        // the temporary lives until we are resumed
+        yield_awaiter yield_value(T&& value) noexcept {
+            current = &value;
+            return {};
+        }
+    };
+
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    generator(promise_type* p) : _promise(p) {}
+    generator(const task_fail_t&) {}
+    generator(generator&& g) : _promise(g._promise) { g._promise = nullptr; }
+    ~generator() {
+        if (_promise) {
+            handle_type::from_promise(*_promise).destroy();
+        }
+    }
+
+    explicit operator bool() const { return _promise != nullptr; }
+
+    struct next_awaiter {
+        promise_type* p;
+
+        bool await_ready() noexcept {
+            return !p || p->get_status() == promise_base::fail ||
+                handle_type::from_promise(*p).done();
+        }
+        std::coroutine_handle<> await_suspend(task_base h) noexcept {
+            promise_base* c = h.get_promise();
+            // tasks we await take these from us, and their failure comes back to the consumer
+            p->self_scheduler = c->self_scheduler;
+            p->no_yield = c->no_yield;
+            p->priority = c->priority;
+            p->arena = c->arena;
+            p->has_error_handler = true;
+            p->caller = h.get_ref();
+            p->consumer = h.get_handle();
+            p->current = nullptr;
+            return handle_type::from_promise(*p);
+        }
+        T* await_resume() noexcept {
+            if (!p || p->get_status() == promise_base::fail) {
+                return nullptr;
+            }
+            return p->current;
+        }
+    };
+
+    // resume the generator until the next value
+    next_awaiter operator co_await() noexcept { return {_promise}; }
+
+    struct sentinel {};
+    struct iterator {
+        promise_type* p;
+
+        T& operator*() const { return *p->current; }
+        iterator& operator++() {
+            __next(p);
+            return *this;
+        }
+        bool operator==(sentinel) const { return !p || !p->current; }
+    };
+
+    iterator begin() {
+        __next(_promise);
+        return {_promise};
+    }
+    sentinel end() { return {}; }
+
+   private:
+    promise_type* _promise = nullptr;
+
+    static void __next(promise_type* p) {
+        if (!p) {
+            return;
+        }
+        auto h = handle_type::from_promise(*p);
+        if (h.done()) {
+            return;
+        }
+        p->consumer = std::noop_coroutine();
+        p->current = nullptr;
+        h.resume();
+        if (!p->current && !h.done()) {
+            panic("generator: suspended on a task while iterated synchronously");
+        }
+    }
+};
+
 struct sleep_awaiter {
     bool await_ready() { return false; }
     std::coroutine_handle<> await_suspend(task_base h) {
         caller = std::move(h);
-        cpu::my_cpu()->sleep(ticks, &caller);
+        node.sleeper = &caller;
+        cpu::my_cpu()->sleep(ticks, &node);
 
         return std::noop_coroutine(); // go to scheduler
     }
     void await_resume() {}
     sleep_awaiter(uint64 ticks) : ticks(ticks) {}
+    sleep_awaiter(sleep_awaiter&& other) : ticks(other.ticks) {} // before suspending only
+    ~sleep_awaiter() {
+        // the frame is destroyed while sleeping
+        if (node.pending()) {
+            timer_wheel::cancel(&node);
+        }
+    }
     private:
     uint64 ticks;
     task_base caller;
+    timer_wheel::node node;
+};
+
+
+// when_all / when_any: run children concurrently on the scheduler of
+// the parent, and resume the parent once.
+// when_all fails the parent if any child fails, when_any fails the parent
+// if all children fail, the failure goes through coroutine_handle_fail.
+// if the shared state cannot be allocated, the await completes at once
+// with every result failed, and the children are never run.
+
+// shared by the parent and children, children may outlive the parent (when_any)
+struct __combinator_state_base : noncopyable {
+    task_base parent;
+    uint32 pending;         // children not done
+    uint32 refs;            // children + awaiter
+    uint32 gate = 2;        // spawner + the child who decides to resume parent
+    int32 first = -1;       // first child succeeded (when_any)
+    bool any;
+    bool failed = false;    // some child failed
+    bool resume_failed = false;
+
+    __combinator_state_base(uint32 n, bool any) : pending(n), refs(n + 1), any(any) {}
+    virtual ~__combinator_state_base() = default;
+
+    void child_done(int32 index, bool ok);
+    // return the handle to continue with if parent should be resumed by us,
+    // nullptr if not, or if the failure ended at a detached root
+    std::coroutine_handle<> open_gate();
+    void release();
+};
+
+template <typename storage_t>
+struct __combinator_state : __combinator_state_base {
+    storage_t results;
+    __combinator_state(uint32 n, bool any) : __combinator_state_base(n, any) {}
+};
+
+void __spawn_child(promise_base* parent, task_base&& child);
+
+template <typename T>
+task<void> __combinator_child(task<T> child, __combinator_state_base* state, optional_storage<T>* out, int32 index) {
+    bool ok = false;
+    if (child) {
+        // it was marked failed in case we could not be allocated, we can run it
+        child.get_promise()->set_init();
+        // we handle its failure
+        child.get_promise()->has_error_handler = true;
+        co_await child;
+        ok = child.get_promise()->get_status() != promise_base::fail;
+        if (ok) {
+            *out = std::move(child.get_promise()->result);
+        }
+    }
+    state->child_done(index, ok);
+    co_return task_ok;
+}
+
+template <typename T>
+typename task<T>::ret_opt_type __take_result(optional_storage<T>& s) {
+    typename task<T>::ret_opt_type ret = std::move(s);
+    return ret;
+}
+
+struct __combinator_awaiter_base {
+    __combinator_state_base* state = nullptr;
+    std::vector<task<void>> children;
+    bool alloc_fail = false; // no state, we complete at once with all failed
+
+    __combinator_awaiter_base() {}
+    __combinator_awaiter_base(__combinator_awaiter_base&& other)
+        : state(other.state), children(std::move(other.children)), alloc_fail(other.alloc_fail) {
+        other.state = nullptr;
+    }
+
+    ~__combinator_awaiter_base() {
+        if (state) {
+            state->release();
+        }
+    }
+
+    bool await_ready() { return alloc_fail || (state && children.empty()); }
+    std::coroutine_handle<> await_suspend(task_base h);
+
+    protected:
+    // a task we could not take never runs, let it be destroyed as failed
+    template <typename T>
+    static void __discard(task<T>& t) {
+        if (t) {
+            t.get_promise()->set_fail();
+        }
+    }
+
+    // if our frame cannot be allocated, the moved-in task is destroyed
+    // without running, so it is marked failed first and the child undoes it
+    template <typename T>
+    static task<void> __child(task<T>&& t, __combinator_state_base* s, optional_storage<T>* out, int32 index) {
+        __discard(t);
+        return __combinator_child<T>(std::move(t), s, out, index);
+    }
 };
 
+template <typename... Ts>
+struct when_all_awaiter : __combinator_awaiter_base {
+    using state_t = __combinator_state<std::tuple<optional_storage<Ts>...>>;
+
+    when_all_awaiter(task<Ts>&&... tasks) {
+        auto s = new (std::nothrow) state_t(sizeof...(Ts), false);
+        if (!s) {
+            alloc_fail = true;
+            (__discard(tasks), ...);
+            return;
+        }
+        state = s;
+        __init(s, std::index_sequence_for<Ts...>{}, std::move(tasks)...);
+    }
+
+    std::tuple<typename task<Ts>::ret_opt_type...> await_resume() {
+        if (alloc_fail) {
+            return {};
+        }
+        return std::apply([](auto&... r) {
+            return std::make_tuple(__take_result(r)...);
+        }, ((state_t*)state)->results);
+    }
+
+    private:
+    template <std::size_t... Is>
+    void __init(state_t* s, std::index_sequence<Is...>, task<Ts>&&... tasks) {
+        children.reserve(sizeof...(Ts));
+        (children.push_back(__child<Ts>(std::move(tasks), s, &std::get<Is>(s->results), Is)), ...);
+    }
+};
+
+template <typename T>
+struct when_range_awaiter : __combinator_awaiter_base {
+    using state_t = __combinator_state<std::vector<optional_storage<T>>>;
+
+    uint32 count;
+
+    when_range_awaiter(std::vector<task<T>>&& tasks, bool any) : count(tasks.size()) {
+        auto s = new (std::nothrow) state_t(tasks.size(), any);
+        if (!s) {
+            this->alloc_fail = true;
+            for (auto& t : tasks) {
+                this->__discard(t);
+            }
+            return;
+        }
+        state = s;
+        s->results.resize(tasks.size());
+        children.reserve(tasks.size());
+        for (uint32 i = 0; i < tasks.size(); i++) {
+            children.push_back(this->__child(std::move(tasks[i]), s, &s->results[i], i));
+        }
+    }
+};
+
+template <typename T>
+struct when_all_range_awaiter : when_range_awaiter<T> {
+    using when_range_awaiter<T>::when_range_awaiter;
+
+    std::vector<typename task<T>::ret_opt_type> await_resume() {
+        std::vector<typename task<T>::ret_opt_type> ret;
+        if (this->alloc_fail) {
+            ret.resize(this->count);
+            return ret;
+        }
+        auto& results = ((typename when_range_awaiter<T>::state_t*)this->state)->results;
+        ret.reserve(results.size());
+        for (auto& r : results) {
+            ret.push_back(__take_result(r));
+        }
+        return ret;
+    }
+};
+
+template <typename T>
+struct when_any_awaiter : when_range_awaiter<T> {
+    using when_range_awaiter<T>::when_range_awaiter;
+
+    // index of the first child that succeeded, and its result
+    std::pair<int32, typename task<T>::ret_opt_type> await_resume() {
+        auto s = (typename when_range_awaiter<T>::state_t*)this->state;
+        if (this->alloc_fail || s->first < 0) {
+            return {-1, {}};
+        }
+        return {s->first, __take_result(s->results[s->first])};
+    }
+};
+
+template <typename... Ts>
+when_all_awaiter<Ts...> when_all(task<Ts>&&... tasks) {
+    return {std::move(tasks)...};
+}
+
+template <typename T>
+when_all_range_awaiter<T> when_all(std::vector<task<T>>&& tasks) {
+    return {std::move(tasks), false};
+}
+
+template <typename T>
+when_any_awaiter<T> when_any(std::vector<task<T>>&& tasks) {
+    return {std::move(tasks), true};
+}
+
+template <typename T, typename... Ts>
+when_any_awaiter<T> when_any(task<T>&& t, task<Ts>&&... tasks) {
+    static_assert((std::is_same_v<T, Ts> && ...), "when_any: all tasks should have same type");
+    std::vector<task<T>> v;
+    v.reserve(1 + sizeof...(Ts));
+    v.push_back(std::move(t));
+    (v.push_back(std::move(tasks)), ...);
+    return {std::move(v), true};
+}
+
 
 #endif
\ No newline at end of file
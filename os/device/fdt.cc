@@ -0,0 +1,197 @@
+#include "fdt.h"
+
+#include <mm/utils.h>
+
+static constexpr uint32 FDT_MAGIC = 0xd00dfeed;
+static constexpr uint32 FDT_BEGIN_NODE = 1;
+static constexpr uint32 FDT_END_NODE = 2;
+static constexpr uint32 FDT_PROP = 3;
+static constexpr uint32 FDT_NOP = 4;
+static constexpr uint32 FDT_END = 9;
+
+// all fields are big endian
+struct fdt_header {
+    uint32 magic;
+    uint32 totalsize;
+    uint32 off_dt_struct;
+    uint32 off_dt_strings;
+    uint32 off_mem_rsvmap;
+    uint32 version;
+    uint32 last_comp_version;
+    uint32 boot_cpuid_phys;
+    uint32 size_dt_strings;
+    uint32 size_dt_struct;
+};
+
+static uint32 be32(const void* p) {
+    return __builtin_bswap32(*(const uint32*)p);
+}
+
+static char lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+// does [s, s+len) equal ext, ignoring case
+static bool ext_equal(const char* s, int len, const char* ext) {
+    int i = 0;
+    for (; i < len && ext[i]; i++) {
+        if (lower(s[i]) != lower(ext[i])) {
+            return false;
+        }
+    }
+    return i == len && !ext[i];
+}
+
+// multi-letter extensions follow the single letter base, separated by '_'
+static bool isa_string_has(const char* isa, int len, const char* ext) {
+    int start = 0;
+    for (int i = 0; i <= len; i++) {
+        if (i == len || isa[i] == '_' || isa[i] == '\0') {
+            if (start > 0 && ext_equal(isa + start, i - start, ext)) {
+                return true;
+            }
+            if (i == len || isa[i] == '\0') {
+                break;
+            }
+            start = i + 1;
+        }
+    }
+    return false;
+}
+
+static bool string_list_has(const char* list, int len, const char* ext) {
+    for (int i = 0; i < len;) {
+        int n = strlen(list + i);
+        if (ext_equal(list + i, n, ext)) {
+            return true;
+        }
+        i += n + 1;
+    }
+    return false;
+}
+
+// locate the structure block and the strings, false if it is no fdt
+static bool fdt_blocks(const void* fdt, const uint8** p, const uint8** end, const char** strings) {
+    if (!fdt) {
+        return false;
+    }
+    const fdt_header* h = (const fdt_header*)fdt;
+    if (be32(&h->magic) != FDT_MAGIC) {
+        return false;
+    }
+
+    const uint8* base = (const uint8*)fdt;
+    *p = base + be32(&h->off_dt_struct);
+    *end = *p + be32(&h->size_dt_struct);
+    *strings = (const char*)base + be32(&h->off_dt_strings);
+    return true;
+}
+
+bool fdt_cpus_have_extension(const void* fdt, const char* ext) {
+    const uint8* p;
+    const uint8* end;
+    const char* strings;
+    if (!fdt_blocks(fdt, &p, &end, &strings)) {
+        return false;
+    }
+
+    int depth = 0;
+    int cpu_depth = -1; // depth of the cpu node we are in
+    bool cpu_has = false;
+    int cpus = 0;
+    int matched = 0;
+
+    while (p < end) {
+        uint32 token = be32(p);
+        p += 4;
+        switch (token) {
+        case FDT_BEGIN_NODE: {
+            const char* name = (const char*)p;
+            int n = strlen(name);
+            p += (n + 1 + 3) & ~3;
+            depth++;
+            if (cpu_depth < 0 && strncmp(name, "cpu@", 4) == 0) {
+                cpu_depth = depth;
+                cpu_has = false;
+                cpus++;
+            }
+            break;
+        }
+        case FDT_END_NODE:
+            if (depth == cpu_depth) {
+                matched += cpu_has;
+                cpu_depth = -1;
+            }
+            depth--;
+            break;
+        case FDT_PROP: {
+            uint32 len = be32(p);
+            const char* name = strings + be32(p + 4);
+            const char* value = (const char*)p + 8;
+            p += 8 + ((len + 3) & ~3);
+            if (depth != cpu_depth) {
+                break;
+            }
+            if (strcmp(name, "riscv,isa") == 0) {
+                cpu_has |= isa_string_has(value, len, ext);
+            } else if (strcmp(name, "riscv,isa-extensions") == 0) {
+                cpu_has |= string_list_has(value, len, ext);
+            }
+            break;
+        }
+        case FDT_NOP:
+            break;
+        case FDT_END:
+            return cpus > 0 && matched == cpus;
+        default:
+            return false;
+        }
+    }
+    return false;
+}
+
+const char* fdt_chosen_bootargs(const void* fdt) {
+    const uint8* p;
+    const uint8* end;
+    const char* strings;
+    if (!fdt_blocks(fdt, &p, &end, &strings)) {
+        return nullptr;
+    }
+
+    int depth = 0;
+    bool in_chosen = false; // /chosen, a child of the root
+    while (p < end) {
+        uint32 token = be32(p);
+        p += 4;
+        switch (token) {
+        case FDT_BEGIN_NODE: {
+            const char* name = (const char*)p;
+            int n = strlen(name);
+            p += (n + 1 + 3) & ~3;
+            depth++;
+            if (depth == 2) {
+                in_chosen = strcmp(name, "chosen") == 0;
+            }
+            break;
+        }
+        case FDT_END_NODE:
+            depth--;
+            break;
+        case FDT_PROP: {
+            uint32 len = be32(p);
+            const char* name = strings + be32(p + 4);
+            const char* value = (const char*)p + 8;
+            p += 8 + ((len + 3) & ~3);
+            if (in_chosen && depth == 2 && len > 0 && strcmp(name, "bootargs") == 0) {
+                return value;
+            }
+            break;
+        }
+        case FDT_NOP:
+            break;
+        default: // FDT_END or malformed
+            return nullptr;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,17 @@
+// just enough of a flattened device tree reader to look at the cpus
+#ifndef DEVICE_FDT_H
+#define DEVICE_FDT_H
+
+#include <ccore/types.h>
+
+// true if every cpu node lists the isa extension (e.g. "sstc"), either in
+// "riscv,isa" ("rv64imafdch_zicsr_sstc") or in "riscv,isa-extensions".
+// fdt is the physical address handed over by sbi in a1, it is read before
+// paging is on. false if the blob is missing or malformed.
+bool fdt_cpus_have_extension(const void* fdt, const char* ext);
+
+// the kernel command line in /chosen/bootargs (qemu -append), nullptr if
+// there is none. it points into the blob, read it before paging is on.
+const char* fdt_chosen_bootargs(const void* fdt);
+
+#endif // DEVICE_FDT_H
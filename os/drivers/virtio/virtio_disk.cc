@@ -328,7 +328,8 @@ void virtio_disk::virtio_disk_intr() {
         used_idx += 1;
 
         info[id].done = true;
-        info[id].wait_queue.wake_up();
+        // the request is done, its waiter goes ahead of normal tasks
+        info[id].wait_queue.wake_up_critical();
 
         // debug_core("virtio_disk_intr: id %d, used_idx: %d", id, used_idx);
     }
@@ -62,7 +62,7 @@ class inode : public referenceable_buffer<inode> {
     virtual task<int32> lookup(shared_ptr<dentry> new_dentry) { co_return -EPERM; };
 
     // generator
-    virtual task<shared_ptr<dentry>> read_dir() { co_return nullptr; };
+    virtual generator<shared_ptr<dentry>> read_dir() { co_return; };
 
     virtual task<int32> link(shared_ptr<dentry> old_dentry, shared_ptr<dentry> new_dentry)  { co_return -EPERM; };
     virtual task<int32> symlink(shared_ptr<dentry> old_dentry, shared_ptr<dentry> new_dentry)  { co_return -EPERM; };
@@ -25,7 +25,7 @@ void nfs_inode::on_destroy(weak_ptr<nfs_inode> self) {
         auto ptr = self.lock();
         if (ptr && ptr->flush_needed()) {
             debugf("nfs_inode::on_destroy: %d", ptr->inode_number);
-            kernel_task_scheduler[0].schedule(std::move(((nfs*)ptr->fs)->put_inode(ptr)));
+            kernel_task_scheduler[0].schedule(std::move(((nfs*)ptr->fs)->put_inode(ptr)), task_priority::background);
         }
     }
     
@@ -167,13 +167,15 @@ task<int64> nfs_inode::data_rw(std::conditional_t<_write, const uint8 *, uint8*>
     uint32 data_block_offset = 0;
 
 
+    // direct blocks are independent, if we touch more than one, do them in parallel
+    std::vector<task<void>> direct_tasks;
     while (offset < DIRECT_DATA_SIZE && size > 0) {
         addr_block_offset = offset / BLOCK_SIZE;
         data_block_offset = offset % BLOCK_SIZE;
         block_rw_size = std::min(size, (uint64)BLOCK_SIZE - data_block_offset);
 
 
-        co_await direct_data_block_rw<_write>(addr_block_offset, data_block_offset, buf, block_rw_size);
+        direct_tasks.push_back(direct_data_block_rw<_write>(addr_block_offset, data_block_offset, buf, block_rw_size));
         
         offset += block_rw_size;
         buf += block_rw_size;
@@ -181,6 +183,12 @@ task<int64> nfs_inode::data_rw(std::conditional_t<_write, const uint8 *, uint8*>
         rw_size += block_rw_size;
     }
 
+    if (direct_tasks.size() == 1) {
+        co_await direct_tasks[0];
+    } else if (direct_tasks.size() > 1) {
+        co_await when_all(std::move(direct_tasks));
+    }
+
     
 
     if(size == 0) {
@@ -462,7 +470,7 @@ task<int32> nfs_inode::lookup(shared_ptr<dentry> new_dentry) {
     }
 }
 // generator
-task<shared_ptr<dentry>> nfs_inode::read_dir() {
+generator<shared_ptr<dentry>> nfs_inode::read_dir() {
 
     // make metadata valid
     co_await load();
@@ -479,13 +487,13 @@ task<shared_ptr<dentry>> nfs_inode::read_dir() {
     
     while (true) {
         if (offset >= metadata.size) {
-            co_return nullptr;
+            co_return;
         }
 
         int64 read_size = *co_await read(&_dirent, offset, sizeof(dirent));
         if (read_size != sizeof(dirent)) {
             warnf("read dirent failed");
-            co_return nullptr;
+            co_return;
         }
         offset += sizeof(dirent);
         if (_dirent.inode_number == 0) {
@@ -23,7 +23,7 @@ class nfs_inode : public inode {
     virtual task<int32> create(shared_ptr<dentry> new_dentry) override;
     virtual task<int32> lookup(shared_ptr<dentry> new_dentry) override;
     // generator
-    virtual task<shared_ptr<dentry>> read_dir() override;
+    virtual generator<shared_ptr<dentry>> read_dir() override;
 
     virtual task<int32> link(shared_ptr<dentry> old_dentry, shared_ptr<dentry> new_dentry) override;
     virtual task<int32> symlink(shared_ptr<dentry> old_dentry, shared_ptr<dentry> new_dentry) override;
@@ -63,8 +63,6 @@ task<void> nfs::mount(device_id_t _device_id) {
 
 // flush all buffers and write superblock
 task<void> nfs::unmount() {
-    auto bdev = (block_device*)(dev);
-
     lock.lock();
     if (unmounted) {
         lock.unlock();
@@ -107,18 +105,11 @@ task<void> nfs::unmount() {
     
     
 
+    // flushing the inode table updates sb, write it out afterwards
     co_await inode_table->flush();
     inode_table = nullptr;
 
-    if (sb_dirty) {
-        auto buf_ptr = *co_await kernel_block_buffer.get(bdev, SUPER_BLOCK_INDEX);
-        auto buf_ref = *co_await buf_ptr->get_ref();
-
-        *(superblock*)(buf_ref->data) = sb;
-        buf_ref->mark_dirty();
-
-        sb_dirty = false;
-    }
+    co_await write_superblock();
 
     // print();
 
@@ -133,6 +124,22 @@ task<void> nfs::unmount() {
     co_return task_ok;
 }
 
+task<void> nfs::write_superblock() {
+    auto bdev = (block_device*)(dev);
+
+    if (sb_dirty) {
+        auto buf_ptr = *co_await kernel_block_buffer.get(bdev, SUPER_BLOCK_INDEX);
+        auto buf_ref = *co_await buf_ptr->get_ref();
+
+        *(superblock*)(buf_ref->data) = sb;
+        buf_ref->mark_dirty();
+
+        sb_dirty = false;
+    }
+
+    co_return task_ok;
+}
+
 task<shared_ptr<inode>> nfs::get_root() {
     co_return root_inode;
 }
@@ -36,6 +36,9 @@ class nfs : public filesystem {
 
     static task<void> make_fs(device_id_t device_id, uint32 nblocks);
 
+    // write sb to its block buffer if dirty
+    task<void> write_superblock();
+
     void print();
 
     // TODO: private:
@@ -21,6 +21,7 @@
 #include <coroutine.h>
 #include <task_scheduler.h>
 
+#include <device/fdt.h>
 #include <drivers/virtio/virtio_disk.h>
 #include <drivers/ramdisk/ramdisk.h>
 
@@ -83,14 +84,47 @@ void test_coroutine(){
 
 
 
-void idle(){
-    kernel_assert(cpu::local_irq_on() && (r_sie() & SIE_STIE), "timer interrupt should be enabled");
-    warnf("%d: idle: start", cpu::my_cpu()->get_core_id());
-    while (true){
-        asm volatile("wfi");
+// executor_cores=1,3 dedicates harts 1 and 3 to the coroutine executor.
+// at least one hart is left for processes, or the option is ignored
+static void parse_bootargs(const char* args) {
+    static const char option[] = "executor_cores=";
+    const int option_len = sizeof(option) - 1;
+    for (const char* p = args; p && *p; ) {
+        while (*p == ' ') {
+            p++;
+        }
+        if (strncmp(p, option, option_len) != 0) {
+            while (*p && *p != ' ') {
+                p++;
+            }
+            continue;
+        }
+
+        uint64 mask = 0;
+        p += option_len;
+        while (*p >= '0' && *p <= '9') {
+            int id = 0;
+            while (*p >= '0' && *p <= '9') {
+                id = id * 10 + (*p++ - '0');
+            }
+            if (id < NCPU) {
+                mask |= 1ul << id;
+            }
+            if (*p == ',') {
+                p++;
+            }
+        }
+        if (mask == (1ul << NCPU) - 1) {
+            warnf("executor_cores: no hart left for processes, ignored");
+            continue;
+        }
+        for (int i = 0; i < NCPU; i++) {
+            if (mask & (1ul << i)) {
+                cpus[i].set_executor_only();
+                infof("[ccore] Hart %d:      executor only", i);
+            }
+        }
     }
-    kernel_assert(false, "idle should not return");
-    __builtin_unreachable();
 }
 
 void init(){
@@ -150,8 +184,6 @@ extern "C" void kernel_init(uint64 hartid, uint64 device_tree)
 
 	//magic = 0xbeefdead;
 
-    (void)(device_tree);
-
     // set pagetables 
     if (is_first){
         is_first = false;
@@ -178,9 +210,16 @@ extern "C" void kernel_init(uint64 hartid, uint64 device_tree)
         infof("[ccore] s_bss_stack: %p, e_bss_stack: %p", boot_stack_top, boot_stack_bottom);
         infof("[ccore] s_bss:       %p, e_bss:       %p", s_bss, e_bss);
 
+        // paging is off, the device tree is reachable by its physical address
+        timer::detect_sstc((const void*)device_tree);
+        infof("[ccore] Sstc:         %s", timer::has_sstc() ? "stimecmp" : "sbi set_timer");
+
         // init cpu (id and temp_stack)
         init_cpus();
 
+        // still before paging, bootargs point into the device tree
+        parse_bootargs(fdt_chosen_bootargs((const void*)device_tree));
+
         // make page table
         kvminit();
 
@@ -211,29 +250,22 @@ extern "C" void kernel_init(uint64 hartid, uint64 device_tree)
     infof("hart %d starting", hartid);
 
     infof("init scheduler");
-    kernel_process_scheduler[hartid].set_queue(&kernel_process_queue);
-
-
-    // create idle process
-    //infof("create idle process");
-    shared_ptr<process> idle_proc = make_shared<kernel_process>(hartid+1, (kernel_process::func_type)idle);
-    idle_proc->binding_core = hartid;
-    idle_proc->set_name("idle");
-    //debugf("idle_proc %p: state:%d",idle_proc.get(), idle_proc->get_state());
+    kernel_process_scheduler[hartid].set_queue(&kernel_process_queue.queue(hartid));
 
-    //infof("set idle process");
-    kernel_process_scheduler[hartid].last_choice = idle_proc;
 
-    // create task_scheduler process
+    // create task_scheduler process, it takes the pid of the idle process
+    // and runs whenever no process is ready (it parks when out of tasks)
     kernel_task_scheduler[hartid].set_queue(&kernel_task_queue);
+    kernel_task_scheduler[hartid].set_core(hartid);
     //infof("create task_scheduler process");
-    shared_ptr<process> task_scheduler_proc = make_shared<kernel_process>(kernel_process_queue.alloc_pid(), task_scheduler_run, (void*)&hartid, sizeof(hartid));
+    shared_ptr<process> task_scheduler_proc = make_shared<kernel_process>(hartid+1, task_scheduler_run, (void*)&hartid, sizeof(hartid));
     task_scheduler_proc->binding_core = hartid;
     task_scheduler_proc->set_name("task_scheduler");
+    task_scheduler_proc->set_runnable(); // never queued
     //debugf("task_scheduler_proc %p: state:%d",task_scheduler_proc.get(), task_scheduler_proc->get_state());
 
-    infof("push task_scheduler process");
-    kernel_process_queue.push(task_scheduler_proc);
+    infof("set task_scheduler process");
+    kernel_process_scheduler[hartid].last_choice = task_scheduler_proc;
     
 
     if (hartid == 0){
@@ -0,0 +1,101 @@
+#include "frame_arena.h"
+
+#include <atomic/lock.h>
+#include <arch/cpu.h>
+#include <proc/process.h>
+
+frame_arena_pool kernel_frame_arenas;
+
+void* frame_arena::alloc(std::size_t size) noexcept {
+    uint32 need = HEADER_SIZE + ((size + 15) & ~15ul);
+
+    auto guard = make_lock_guard(lock);
+    if (need > CHUNK_SIZE - top) {
+        return nullptr;
+    }
+    header* h = __header(top);
+    h->prev = last;
+    h->freed = 0;
+    last = top;
+    top += need;
+    refs++;
+    return (uint8*)h + HEADER_SIZE;
+}
+
+void frame_arena::free(void* ptr) noexcept {
+    bool release = false;
+    {
+        auto guard = make_lock_guard(lock);
+        __header((uint8*)ptr - memory - HEADER_SIZE)->freed = 1;
+
+        // pop all freed frames on the top
+        while (last != NONE && __header(last)->freed) {
+            top = last;
+            last = __header(last)->prev;
+        }
+        release = --refs == 0;
+    }
+    if (release) {
+        __release();
+    }
+}
+
+void frame_arena::put() {
+    bool release = false;
+    {
+        auto guard = make_lock_guard(lock);
+        release = --refs == 0;
+    }
+    if (release) {
+        __release();
+    }
+}
+
+void frame_arena::__release() {
+    top = 0;
+    last = NONE;
+    kernel_frame_arenas.release(this);
+}
+
+frame_arena* frame_arena::current() {
+    bool old = cpu::local_irq_save();
+    process* p = cpu::__my_cpu()->get_current_process();
+    frame_arena* ret = p ? p->current_arena : nullptr;
+    cpu::local_irq_restore(old);
+    return ret;
+}
+
+frame_arena* frame_arena::set_current(frame_arena* arena) {
+    bool old = cpu::local_irq_save();
+    process* p = cpu::__my_cpu()->get_current_process();
+    frame_arena* ret = nullptr;
+    if (p) {
+        ret = p->current_arena;
+        p->current_arena = arena;
+    }
+    cpu::local_irq_restore(old);
+    return ret;
+}
+
+frame_arena_pool::frame_arena_pool() {
+    for (uint32 i = 0; i < ARENA_COUNT; i++) {
+        arenas[i].next_free = free_list;
+        free_list = &arenas[i];
+    }
+}
+
+frame_arena* frame_arena_pool::acquire() {
+    auto guard = make_lock_guard(lock);
+    frame_arena* arena = free_list;
+    if (arena) {
+        free_list = arena->next_free;
+        arena->refs = 1;
+    }
+    return arena;
+}
+
+void frame_arena_pool::release(frame_arena* arena) {
+    auto guard = make_lock_guard(lock);
+    arena->next_free = free_list;
+    free_list = arena;
+}
@@ -0,0 +1,85 @@
+// bump arenas for coroutine frames of one task tree
+#ifndef MM_FRAME_ARENA_H
+#define MM_FRAME_ARENA_H
+
+#include <ccore/types.h>
+#include <atomic/spinlock.h>
+
+#include <cstddef>
+
+// child coroutines of a call chain never outlive their parent, so their
+// frames can be bump allocated from a chunk the root task reserves and
+// given back in stack order. a frame freed out of order is only marked,
+// the space below the top is reclaimed once the frames above it are gone.
+// the chunk goes back to the pool when the root and all frames are gone.
+// frames may be freed on other cores (tasks are stolen), so we take a lock,
+// it is still much cheaper than the heap.
+class frame_arena {
+   public:
+    static constexpr uint32 CHUNK_SIZE = 16 * 1024;
+
+    // return nullptr when the chunk is full, the caller falls back to heap
+    void* alloc(std::size_t size) noexcept;
+    void free(void* ptr) noexcept;
+
+    // the root task holds one reference
+    void put();
+
+    // arena of the coroutine running in current process, may be nullptr
+    static frame_arena* current();
+    // set by task scheduler around resume, return the old one
+    static frame_arena* set_current(frame_arena* arena);
+
+   private:
+    friend class frame_arena_pool;
+
+    static constexpr uint32 HEADER_SIZE = 16;
+    static constexpr uint32 NONE = ~0u;
+
+    struct header {
+        uint32 prev; // offset of the frame below us, or NONE
+        uint32 freed;
+    };
+
+    header* __header(uint32 offset) {
+        return (header*)(memory + offset);
+    }
+    void __release();
+
+    alignas(16) uint8 memory[CHUNK_SIZE];
+    spinlock lock {"frame_arena.lock"};
+    uint32 top = 0;
+    uint32 last = NONE;
+    uint32 refs = 0;
+    frame_arena* next_free = nullptr;
+};
+
+// a fixed region of arenas, so telling an arena frame from a heap frame is
+// just a range check on free
+class frame_arena_pool {
+   public:
+    static constexpr uint32 ARENA_COUNT = 16;
+
+    frame_arena_pool();
+
+    // return nullptr if all arenas are in use
+    frame_arena* acquire();
+    void release(frame_arena* arena);
+
+    frame_arena* owner_of(void* ptr) {
+        uint8* p = (uint8*)ptr;
+        if (p < (uint8*)arenas || p >= (uint8*)(arenas + ARENA_COUNT)) {
+            return nullptr;
+        }
+        return &arenas[(p - (uint8*)arenas) / sizeof(frame_arena)];
+    }
+
+   private:
+    frame_arena arenas[ARENA_COUNT];
+    spinlock lock {"frame_arena_pool.lock"};
+    frame_arena* free_list = nullptr;
+};
+
+extern frame_arena_pool kernel_frame_arenas;
+
+#endif // MM_FRAME_ARENA_H
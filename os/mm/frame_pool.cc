@@ -0,0 +1,53 @@
+#include "frame_pool.h"
+#include "allocator.h"
+
+#include <arch/cpu.h>
+
+frame_pool kernel_frame_pool;
+
+void* frame_pool::alloc(std::size_t size) noexcept {
+    int c = size_class(size);
+    if (c < 0) {
+        return operator new(size);
+    }
+
+    {
+        bool old = cpu::local_irq_save();
+        cpu_pool& pool = pools[cpu::current_id()];
+        free_frame* frame = pool.head[c];
+        if (frame) {
+            pool.head[c] = frame->next;
+            pool.count[c]--;
+        }
+        cpu::local_irq_restore(old);
+
+        if (frame) {
+            return frame;
+        }
+    }
+
+    return operator new(1ul << (c + MIN_SHIFT));
+}
+
+void frame_pool::free(void* ptr, std::size_t size) noexcept {
+    int c = size_class(size);
+    if (c < 0) {
+        operator delete(ptr);
+        return;
+    }
+
+    bool old = cpu::local_irq_save();
+    cpu_pool& pool = pools[cpu::current_id()];
+    bool cached = pool.count[c] < MAX_CACHED;
+    if (cached) {
+        free_frame* frame = (free_frame*)ptr;
+        frame->next = pool.head[c];
+        pool.head[c] = frame;
+        pool.count[c]++;
+    }
+    cpu::local_irq_restore(old);
+
+    if (!cached) {
+        operator delete(ptr);
+    }
+}
@@ -0,0 +1,53 @@
+// per-cpu pool for coroutine frames
+#ifndef MM_FRAME_POOL_H
+#define MM_FRAME_POOL_H
+
+#include <ccore/types.h>
+#include <arch/config.h>
+
+#include <cstddef>
+
+// coroutine frames are short-lived and come in few sizes, so we keep
+// freed frames in per-cpu free lists bucketed by power-of-two size.
+// a core only touches its own lists with local irq disabled, no lock needed.
+// frames may be freed on another core, they just go to that core's lists.
+class frame_pool {
+   public:
+    static constexpr int MIN_SHIFT = 6;   // 64 bytes
+    // larger frames go to the heap as they are, not rounded up: pooling them
+    // would double their memory and take the warned large object path
+    static constexpr int MAX_SHIFT = 10;  // 1 KiB
+    static constexpr int CLASS_COUNT = MAX_SHIFT - MIN_SHIFT + 1;
+    static constexpr uint32 MAX_CACHED = 128; // per cpu, per class
+
+    // return nullptr on failure
+    void* alloc(std::size_t size) noexcept;
+    void free(void* ptr, std::size_t size) noexcept;
+
+   private:
+    struct free_frame {
+        free_frame* next;
+    };
+
+    struct __attribute__((aligned(64))) cpu_pool {
+        free_frame* head[CLASS_COUNT] {};
+        uint32 count[CLASS_COUNT] {};
+    };
+
+    cpu_pool pools[NCPU];
+
+    // -1 means too large to be pooled
+    static int size_class(std::size_t size) {
+        if (size > (1ul << MAX_SHIFT)) {
+            return -1;
+        }
+        if (size <= (1ul << MIN_SHIFT)) {
+            return 0;
+        }
+        return (64 - __builtin_clzl(size - 1)) - MIN_SHIFT;
+    }
+};
+
+extern frame_pool kernel_frame_pool;
+
+#endif // MM_FRAME_POOL_H
@@ -1,4 +1,5 @@
 #include "process.h"
+#include "scheduler.h"
 
 #include <utils/log.h>
 #include <mm/vmem.h>
@@ -36,13 +37,46 @@ void process::sleep() {
 void process::wake_up() {
     
     lock.lock();
+    shared_ptr<process> self;
     if(_state == SLEEPING) {
-        stride = cpu::my_cpu()->get_stride(); // TODO: WARNING: this is not right, but works for now
         _state = WAKEN_UP;
+        // if not parked yet, the scheduler sees WAKEN_UP and queues it
+        self = std::move(sleep_ref);
         
         // debugf("wake up %s", name);
     }
     lock.unlock();
+
+    if (self) {
+        kernel_process_queue.wake_up(self);
+    }
+}
+
+bool process::try_preempt() {
+    auto guard = make_lock_guard(lock);
+    if (_state != RUNNING) {
+        return false;
+    }
+    _state = RUNNABLE;
+    return true;
+}
+
+bool process::try_start() {
+    auto guard = make_lock_guard(lock);
+    if (_state != RUNNABLE) {
+        return false;
+    }
+    _state = RUNNING;
+    return true;
+}
+
+bool process::park(const shared_ptr<process>& self) {
+    auto guard = make_lock_guard(lock);
+    if (_state != SLEEPING) {
+        return false;
+    }
+    sleep_ref = self;
+    return true;
 }
 
 
@@ -273,6 +307,8 @@ void process::__kill(){
 void process::kill(){
     lock.lock();
     __kill();
+    // a parked sleeper is gone for good, we may drop the last reference
+    shared_ptr<process> self = std::move(sleep_ref);
     lock.unlock();
     
 }
@@ -286,6 +322,7 @@ void process::__clean_children() {
         child->lock.lock();
         child->parent = nullptr;
         child->__kill();
+        shared_ptr<process> parked = std::move(child->sleep_ref); // still in children
         child->lock.unlock();
 
         auto old_it = it;
@@ -447,6 +484,8 @@ void kernel_process::__kernel_function_caller(void(*func_ptr)(void*), void* arg)
 
     //debug_core("kernel function caller: %p\n", (void*)func_ptr);
 
+    // we may be switched to directly by another process
+    kernel_process_scheduler[cpu::current_id()].finish_switch();
 
     cpu::local_irq_enable();
 
@@ -533,6 +572,7 @@ bool kernel_process::run(){
         //debug_core("run kernel process %d, state=%d", pid, (int)_state);
 
         // set stie, not set sie
+        c->program_timer();
         timer::start_timer_interrupt();
         
         c->save_context_and_switch_to(&_context);
@@ -541,9 +581,11 @@ bool kernel_process::run(){
 
     }
 
+    // after direct switches, the one coming back may not be us
+    return cpu::__my_cpu()->get_kernel_process()->__after_run();
+}
 
-    
-
+bool kernel_process::__after_run() {
     {
         auto guard = make_lock_guard(lock);
 
@@ -25,6 +25,16 @@
 #define PROC_NAME_MAX (16)
 
 class promise_base;
+class frame_arena;
+class kernel_process;
+
+// fifo is the latency class: it runs before any stride process, a higher
+// rt_priority first, and keeps the core without a time slice until it
+// sleeps, yields or exits, or a higher fifo process is woken up
+enum class sched_policy {
+    stride,
+    fifo,
+};
 
 class process : public sleepable {
 
@@ -32,13 +42,18 @@ class process : public sleepable {
     // scheduler related
     uint64 stride = 0;
     uint64 priority = 16;
+    sched_policy policy = sched_policy::stride;
+    uint32 rt_priority = 0;         // fifo only
     uint64 cpu_time = 0;            // ms, user and kernel
     uint64 last_start_time = 0;     // ms
     spinlock schedule_lock {"process.schedule_lock"};
 
     int binding_core = -1;        // -1 means no binding
+    int last_core = -1;           // where it ran last, woken up there
 
     promise_base* current_promise = nullptr;
+    // coroutine frames created in this process come from here if not null
+    frame_arena* current_arena = nullptr;
 
 
 
@@ -63,6 +78,7 @@ protected:
     int exit_code = -1;             // Exit status to be returned to parent's wait
     uint64 stack_bottom_va = 0;     // Virtual address of stack
 
+    shared_ptr<process> sleep_ref;  // set while parked
     process *parent = nullptr;      // Parent process
     list<shared_ptr<process>> children;
     wait_queue wait_children_queue;
@@ -100,6 +116,16 @@ protected:
     void sleep() override;
     void wake_up() override;
 
+    // a sleeping process is in no run queue, it holds a reference to itself
+    // until wake_up puts it back. false if it is not sleeping any more.
+    bool park(const shared_ptr<process>& self);
+
+    // state changes of a direct switch, false if the state is not as expected
+    bool try_preempt(); // RUNNING -> RUNNABLE
+    bool try_start();   // RUNNABLE -> RUNNING
+
+    virtual kernel_process* as_kernel_process() { return nullptr; }
+
     void set_name(const char* name);
     const char* get_name() const;
     int get_pid() const { return pid; }
@@ -235,11 +261,14 @@ class kernel_process : public process {
     bool run() override;
     void exit(int code);
     context* get_context() { return &_context; }
+    kernel_process* as_kernel_process() override { return this; }
 
     protected:
     virtual void __clean_resources() override;
 
     private:
+    // state handling once we are back in the scheduler
+    bool __after_run();
     
     static void __kernel_function_caller(void(*func_ptr)(void*), void *arg);
 };
@@ -6,8 +6,10 @@
 
 #include <arch/cpu.h>
 #include <utils/assert.h>
+#include <task_scheduler.h>
+#include <sbi/sbi.h>
 
-process_queue kernel_process_queue;
+process_run_queues kernel_process_queue;
 
 process_scheduler kernel_process_scheduler[NCPU];
 
@@ -33,63 +35,280 @@ int stride_cmp(uint64 a, uint64 b)
 	}
 }
 
-shared_ptr<process> process_queue::pop(int core_id) {
+bool goes_before(const process& a, const process& b) {
+    if (a.policy != b.policy) {
+        return a.policy == sched_policy::fifo;
+    }
+    if (a.policy == sched_policy::fifo) {
+        return a.rt_priority > b.rt_priority;
+    }
+    return stride_cmp(a.stride, b.stride) < 0;
+}
+
+shared_ptr<process> process_queue::pop() {
     auto guard = make_lock_guard(lock);
 
-    if(_queue.empty()){
-        // debug_core("task_queue is empty");
-        return nullptr;
+    while (!_fifo.empty()) {
+        auto proc = __pop_fifo();
+        if (proc->ready()) {
+            return proc;
+        }
     }
+    while (!_heap.empty()) {
+        auto proc = __remove_at(0);
+        if (!proc->ready()) { // killed while queued, nothing to run
+            continue;
+        }
+        __atomic_store_n(&_min_stride, proc->stride, __ATOMIC_RELAXED);
+        return proc;
+    }
+    return nullptr;
+}
 
+shared_ptr<process> process_queue::pop_before(const process& p) {
+    auto guard = make_lock_guard(lock);
 
-    auto min_it = _queue.end();
-    // uint64 min_stride = 0;
-    
-    
-    for(auto it = _queue.begin(); it != _queue.end(); ++it) {
-        auto& proc = *it;
-        if (proc->waken_up()) {
-            proc->set_runnable();
+    while (!_fifo.empty() && !_fifo.front()->ready()) {
+        __pop_fifo();
+    }
+    if (!_fifo.empty()) {
+        return goes_before(*_fifo.front(), p) ? __pop_fifo() : nullptr;
+    }
+    while (!_heap.empty()) {
+        if (!_heap[0]->ready()) {
+            __remove_at(0);
+            continue;
+        }
+        if (!goes_before(*_heap[0], p)) {
+            return nullptr;
+        }
+        auto proc = __remove_at(0);
+        __atomic_store_n(&_min_stride, proc->stride, __ATOMIC_RELAXED);
+        return proc;
+    }
+    return nullptr;
+}
+
+shared_ptr<process> process_queue::steal() {
+    auto guard = make_lock_guard(lock);
+
+    // a waiting fifo process is better off on an idle core
+    for (uint32 i = _fifo.size(); i-- > 0;) {
+        if (_fifo[i]->binding_core == -1 && _fifo[i]->ready()) {
+            auto proc = std::move(_fifo[i]);
+            _fifo.erase(_fifo.begin() + i);
+            __update_runnable();
+            return proc;
+        }
+    }
+    // leaves have the largest strides, they would wait longest here
+    for (uint32 i = _heap.size(); i-- > 0;) {
+        if (_heap[i]->binding_core == -1 && _heap[i]->ready()) {
+            return __remove_at(i);
+        }
+    }
+    return nullptr;
+}
+
+void process_queue::push(const shared_ptr<process>& p) {
+    shared_ptr<process> proc = p;
+    // sleeping, it comes back through wake_up
+    if (proc->park(proc)) {
+        return;
+    }
 
+    auto guard = make_lock_guard(lock);
+    if (proc->waken_up()) {
+        proc->set_runnable();
+    }
+    if (proc->ready()) {
+        __push_runnable(std::move(proc));
+    }
+    // debug_core("push process %p: name: %s, queue_size:%d", proc.get(), proc->get_name(), queue.size());
+}
+
+void process_run_queues::push(const shared_ptr<process>& proc) {
+    int target = proc->binding_core;
+    if (target == -1) {
+        target = cpu::current_id();
+        for (int i = 0; i < NCPU; i++) {
+            if (!cpus[i].is_booted() || cpus[i].is_executor_only()) {
+                continue;
+            }
+            uint32 load = queues[i].runnable();
+            uint32 best = queues[target].runnable();
+            if (cpus[target].is_executor_only() || load < best ||
+                (load == best && cpus[i].busy_permille() < cpus[target].busy_permille())) {
+                target = i;
+            }
+        }
+        // others not booted yet, wait on the first core for processes
+        for (int i = 0; cpus[target].is_executor_only() && i < NCPU; i++) {
+            target = i;
         }
+    }
+    queues[target].push(proc);
+}
 
-        if(!proc->ready()){
-            // debugf("process %p:( name: %s ) not ready" , (*it).get(), (*it)->get_name());
-            continue;
+void process_run_queues::wake_up(const shared_ptr<process>& proc) {
+    int target = proc->binding_core != -1 ? proc->binding_core : proc->last_core;
+    if (target == -1) {
+        push(proc);
+        return;
+    }
+    queues[target].push(proc);
+
+    // whatever stride process runs there gives up the core now, not at the
+    // end of its slice. a fifo one at least as high keeps it (see preempt)
+    bool fifo = proc->policy == sched_policy::fifo;
+    if (fifo) {
+        cpus[target].end_slice();
+    }
+    if (target == cpu::current_id()) {
+        if (fifo) {
+            // we may be under the lock of the timer wheel (woken by advance),
+            // the soft interrupt handler reprograms the timer after we are out
+            w_sip(r_sip() | SIP_SSIP);
         }
-        if(proc->binding_core!=-1 && proc->binding_core!=core_id){
-            // debugf("core %d: skip process %s, binding core %d", core_id, (*it)->get_name(), (*it)->binding_core);
+    } else if (fifo || kernel_process_scheduler[target].is_idle()) {
+        send_ipi(1ul << target);
+    }
+}
+
+int process_run_queues::__busiest(int core_id) {
+    int busiest = -1;
+    for (int i = 0; i < NCPU; i++) {
+        if (i == core_id || !queues[i].runnable()) {
             continue;
         }
-        if(proc->get_state() == process::state::SLEEPING){
-            continue;
+        if (busiest < 0 || queues[i].runnable() > queues[busiest].runnable()) {
+            busiest = i;
         }
+    }
+    return busiest;
+}
 
-        min_it = it;
-        break;
+shared_ptr<process> process_run_queues::pull(int core_id) {
+    if (cpus[core_id].is_executor_only()) {
+        return nullptr;
+    }
+    int victim = __busiest(core_id);
+    if (victim < 0) {
+        return nullptr;
+    }
+    auto proc = queues[victim].steal();
+    if (proc) {
+        // strides of different queues are not comparable, start from the bottom of ours
+        proc->stride = queues[core_id].min_stride();
+    }
+    return proc;
+}
 
-        // if (min_it == _queue.end() || stride_cmp(proc->stride, min_stride) < 0) {
-        //     // debugf("core %d: update min stride %d", core_id, (*it)->stride);
-        //     min_stride = proc->stride;
-        //     min_it = it;
-        // }
+void process_run_queues::balance(int core_id) {
+    if (cpus[core_id].is_executor_only()) {
+        return;
+    }
+    int victim = __busiest(core_id);
+    if (victim < 0) {
+        return;
+    }
+    // the busiest one keeps one more than us at most, and only gives when it
+    // is really busier than us
+    if (queues[victim].runnable() <= queues[core_id].runnable() + 1 ||
+        cpus[victim].busy_permille() <= cpus[core_id].busy_permille()) {
+        return;
     }
+    auto proc = queues[victim].steal();
+    if (proc) {
+        proc->stride = queues[core_id].min_stride();
+        queues[core_id].push(proc);
+    }
+}
 
-    if(min_it == _queue.end()){
-        // debug_core("no process ready");
-        return nullptr;
+int32 process_run_queues::size() {
+    int32 total = 0;
+    for (auto& q : queues) {
+        total += q.size();
+    }
+    return total;
+}
+
+void process_queue::__push_runnable(shared_ptr<process> proc) {
+    if (proc->policy == sched_policy::fifo) {
+        // behind those of the same rt_priority
+        auto it = _fifo.begin();
+        while (it != _fifo.end() && (*it)->rt_priority >= proc->rt_priority) {
+            ++it;
+        }
+        _fifo.insert(it, std::move(proc));
+        __update_runnable();
+        return;
+    }
+    // a long sleeper must not come back far behind and keep the cpu,
+    // this also keeps strides in the heap close enough for stride_cmp
+    if (stride_cmp(proc->stride, _min_stride) < 0) {
+        proc->stride = _min_stride;
     }
+    _heap.push_back(std::move(proc));
+    __sift_up(_heap.size() - 1);
+    __update_runnable();
+}
 
-    auto ret = *min_it;
-    _queue.erase(min_it);
+shared_ptr<process> process_queue::__pop_fifo() {
+    shared_ptr<process> ret = std::move(_fifo.front());
+    _fifo.pop_front();
+    __update_runnable();
+    return ret;
+}
+
+void process_queue::__update_runnable() {
+    __atomic_store_n(&_runnable, _heap.size() + _fifo.size(), __ATOMIC_RELAXED);
+}
 
+shared_ptr<process> process_queue::__remove_at(uint32 i) {
+    shared_ptr<process> ret = std::move(_heap[i]);
+    uint32 last = _heap.size() - 1;
+    if (i != last) {
+        _heap[i] = std::move(_heap[last]);
+    }
+    _heap.pop_back();
+    if (i < _heap.size()) {
+        __sift_down(i);
+        __sift_up(i);
+    }
+    __update_runnable();
     return ret;
 }
 
-void process_queue::push(const shared_ptr<process>& proc) {
-    auto guard = make_lock_guard(lock);
-    _queue.push_back(proc);
-    // debug_core("push process %p: name: %s, queue_size:%d", proc.get(), proc->get_name(), queue.size());
+void process_queue::__sift_up(uint32 i) {
+    while (i > 0) {
+        uint32 parent = (i - 1) / 2;
+        if (stride_cmp(_heap[i]->stride, _heap[parent]->stride) >= 0) {
+            break;
+        }
+        std::swap(_heap[i], _heap[parent]);
+        i = parent;
+    }
+}
+
+void process_queue::__sift_down(uint32 i) {
+    uint32 n = _heap.size();
+    while (true) {
+        uint32 min = i;
+        uint32 left = 2 * i + 1;
+        uint32 right = left + 1;
+        if (left < n && stride_cmp(_heap[left]->stride, _heap[min]->stride) < 0) {
+            min = left;
+        }
+        if (right < n && stride_cmp(_heap[right]->stride, _heap[min]->stride) < 0) {
+            min = right;
+        }
+        if (min == i) {
+            break;
+        }
+        std::swap(_heap[i], _heap[min]);
+        i = min;
+    }
 }
 
 bool run_process(process* p) {
@@ -130,7 +349,19 @@ void process_scheduler::run()
         // wake up those who are waiting for future time
         c->wake_up(); 
         
-        auto process = shared_queue->pop(core_id);
+        task_scheduler& executor = kernel_task_scheduler[core_id];
+        bool tasks_pending = last_choice && !executor.is_free();
+        shared_ptr<process> process;
+        if (tasks_pending) {
+            // the executor takes its turn by stride
+            process = local_queue->pop_before(*last_choice);
+        } else {
+            process = local_queue->pop();
+            if (!process) {
+                // before idling, take work from the busiest core
+                process = kernel_process_queue.pull(core_id);
+            }
+        }
 
         if(!process) {
 
@@ -148,23 +379,43 @@ void process_scheduler::run()
         process->schedule_lock.lock();
 
         uint64 busy_start = r_cycle();
+        uint64 resume_cycles = executor.stats.resume_cycles;
         process->last_start_time = timer::get_time_ms();
+        if (process == last_choice) {
+            // runs alone do not count, or a newcomer would hold the core
+            // until it caught up with us
+            uint64 bottom = local_queue->min_stride();
+            if (!local_queue->runnable() || stride_cmp(process->stride, bottom) < 0) {
+                process->stride = bottom;
+            }
+        }
         uint64 pass = BIG_STRIDE / (process->priority);
         process->stride += pass;
 
         c->set_stride(process->stride);
+        process->last_core = core_id;
 
         process->schedule_lock.unlock();
         
         c->set_process(process.get());
+        // fifo processes and the executor of an executor only core are not preempted
+        c->start_slice(process->policy == sched_policy::fifo ||
+                       (process == last_choice && c->is_executor_only()));
+        __atomic_store_n(&idle, process == last_choice, __ATOMIC_RELAXED);
+        current = process;
         bool reschedule = run_process(process.get());
+        // the one coming back, after direct switches it is not the one we ran
+        process = std::move(current);
+        __atomic_store_n(&idle, false, __ATOMIC_RELAXED);
         c->set_process(nullptr);
 
         process->schedule_lock.lock();
 
-        // idle is not busy
+        // idle is not busy, the executor is while it runs tasks
         if (process != last_choice){
             busy += r_cycle() - busy_start;
+        } else {
+            busy += executor.stats.resume_cycles - resume_cycles;
         }
         
         uint64 time_delta = timer::get_time_ms() - process->last_start_time;
@@ -175,7 +426,7 @@ void process_scheduler::run()
 
         if (reschedule) {
             if (process != last_choice) {
-                shared_queue->push(process);
+                local_queue->push(process);
             }
             
         }
@@ -187,8 +438,82 @@ void process_scheduler::run()
         // sample rate 1 Hz
         if (all > (timer::MS_TO_CYCLE(1000))) {
             c->sample(all, busy);
+            kernel_task_scheduler[core_id].sample_stats();
+            kernel_process_queue.balance(core_id);
             all = 0;
             busy = 0;
         }
     }
-}
\ No newline at end of file
+}
+bool process_scheduler::preempt() {
+    cpu* c = cpu::__my_cpu();
+    if (!current || current == last_choice || !current->as_kernel_process()) {
+        return false;
+    }
+    int core_id = c->get_core_id();
+    shared_ptr<process> prev = current;
+
+    // pending tasks due before us, the executor runs from run only
+    if (!kernel_task_scheduler[core_id].is_free() && goes_before(*last_choice, *prev)) {
+        return false;
+    }
+
+    auto next = local_queue->pop_before(*prev);
+    if (!next) {
+        // still the first to run, take another slice in place
+        prev->schedule_lock.lock();
+        prev->stride += BIG_STRIDE / prev->priority;
+        c->set_stride(prev->stride);
+        prev->schedule_lock.unlock();
+        c->start_slice(prev->policy == sched_policy::fifo);
+        c->program_timer();
+        return true;
+    }
+    // user processes need the trap registers set up by run
+    if (!next->as_kernel_process()) {
+        local_queue->push(next);
+        return false;
+    }
+    if (!next->try_start()) { // killed since popped, nothing to run
+        return false;
+    }
+    if (!prev->try_preempt()) { // exited or killed meanwhile
+        next->try_preempt();
+        local_queue->push(next);
+        return false;
+    }
+
+    uint64 now = timer::get_time_ms();
+    prev->schedule_lock.lock();
+    prev->cpu_time += now - prev->last_start_time;
+    prev->schedule_lock.unlock();
+
+    next->schedule_lock.lock();
+    next->last_start_time = now;
+    next->stride += BIG_STRIDE / next->priority;
+    c->set_stride(next->stride);
+    next->last_core = core_id;
+    next->schedule_lock.unlock();
+
+    c->set_process(next.get());
+    c->start_slice(next->policy == sched_policy::fifo);
+    c->program_timer();
+    direct_switches++;
+
+    context* from = prev->as_kernel_process()->get_context();
+    context* to = next->as_kernel_process()->get_context();
+    switch_prev = std::move(prev);
+    current = std::move(next);
+    swtch(from, to);
+
+    // back on some core, maybe another one
+    kernel_process_scheduler[cpu::current_id()].finish_switch();
+    return true;
+}
+
+void process_scheduler::finish_switch() {
+    if (switch_prev) {
+        auto prev = std::move(switch_prev);
+        local_queue->push(prev);
+    }
+}
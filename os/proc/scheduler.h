@@ -6,40 +6,115 @@
 // #include <utils/list.h>
 #include <atomic/lock.h>
 
+#include <vector>
 #include <deque>
 
 static const uint64 BIG_STRIDE = 0x7FFFFFFFLL;
 
 void init_schedulers();
 
-// TODO: use a priority queue
+int stride_cmp(uint64 a, uint64 b);
+// should a run before b: fifo before stride, then by rt_priority or stride
+bool goes_before(const process& a, const process& b);
+
+// run queue of one core.
+// runnable processes sit in a min-heap by stride, the one with the smallest
+// stride runs next, so a process gets cpu share in proportion to priority.
+// fifo processes wait in a list by rt_priority ahead of all of them.
+// sleeping ones are in no queue, wake_up puts them back (process::park).
 class process_queue {
-    list<shared_ptr<process>> _queue;
-    // std::deque<shared_ptr<process>> _queue;
+    std::vector<shared_ptr<process>> _heap;
+    std::deque<shared_ptr<process>> _fifo;
+    uint64 _min_stride = 0; // stride of the last one popped
+    uint32 _runnable = 0;   // size of heap, read without lock by the balancer
     spinlock lock {"process_queue.lock"};
 
-    spinlock pid_lock {"process_queue.pid_lock"};
-    int next_pid = NCPU + 1; // skip idle process and init process
 public:
-    shared_ptr<process> pop(int core_id);
+    shared_ptr<process> pop();
+    // pop the first one only if it goes before p, nullptr otherwise
+    shared_ptr<process> pop_before(const process& p);
     void push(const shared_ptr<process>& proc);
+    // take out a runnable process not bound to this core, nullptr if none
+    shared_ptr<process> steal();
+    uint32 runnable() const { return __atomic_load_n(&_runnable, __ATOMIC_RELAXED); }
+    uint64 min_stride() const { return __atomic_load_n(&_min_stride, __ATOMIC_RELAXED); }
+    int32 size() { return _heap.size() + _fifo.size(); }
+
+    private:
+    void __push_runnable(shared_ptr<process> proc);
+    shared_ptr<process> __pop_fifo();
+    void __update_runnable();
+    shared_ptr<process> __remove_at(uint32 i);
+    void __sift_up(uint32 i);
+    void __sift_down(uint32 i);
+};
+
+// a run queue per core, so cores do not contend on one lock.
+// a process stays on the core it last ran on, and a bound process only
+// ever sits in the queue of its core. new processes go to the least loaded
+// core, an idle core pulls from the busiest one, and once a second each core
+// evens out with the busiest by the cpu::sample busy ratios.
+// executor only cores take part in none of this.
+class process_run_queues {
+    process_queue queues[NCPU];
+
+    spinlock pid_lock {"process_queue.pid_lock"};
+    int next_pid = NCPU + 1; // skip init process and the executor of each core
+
+public:
     int alloc_pid() {
         auto guard = make_lock_guard(pid_lock);
         return next_pid++;
     }
-    int32 size() { return _queue.size(); }
+
+    process_queue& queue(int core_id) { return queues[core_id]; }
+
+    // place a new process
+    void push(const shared_ptr<process>& proc);
+    // put a woken up process back on the core it slept on, kick that core if
+    // idle, or end its slice for a fifo process
+    void wake_up(const shared_ptr<process>& proc);
+    // steal a process from the busiest core for core_id, nullptr if none
+    shared_ptr<process> pull(int core_id);
+    // move a process to core_id if it is much less loaded than the busiest
+    void balance(int core_id);
+
+    int32 size();
+
+    private:
+    int __busiest(int core_id);
 };
 
+// last_choice is the coroutine executor of the core. it runs whenever no
+// process is ready, and with tasks pending it competes by stride like any
+// process, so tasks neither pay a process switch per round nor starve.
+// it gives the core back when its slice ends, or when out of tasks and a
+// process is queued.
+// the timer handler may switch from one kernel process straight to the
+// next (preempt), without a round trip through run. the process switched
+// away from is pushed back by the one switched to (finish_switch), once its
+// context is saved.
 class process_scheduler {
-    process_queue* shared_queue;
+    process_queue* local_queue;
+    bool idle = false; // running last_choice, no process ready
+    shared_ptr<process> current;     // the one running now, may change under run
+    shared_ptr<process> switch_prev; // switched away from, not queued yet
+    uint64 direct_switches = 0;
     public:
     // process_scheduler::process_scheduler(task_queue* q);
-    void set_queue(process_queue* q) { shared_queue = q; }
+    void set_queue(process_queue* q) { local_queue = q; }
     void run();
+    bool is_idle() const { return __atomic_load_n(&idle, __ATOMIC_RELAXED); }
+    // called by the timer handler when the slice of a kernel process ends.
+    // false if it cannot be decided here, switch_back to run then
+    bool preempt();
+    // called right after a switch lands, on the core it lands on
+    void finish_switch();
+    uint64 get_direct_switches() const { return direct_switches; }
     shared_ptr<process> last_choice;
 };
 
-extern process_queue kernel_process_queue;
+extern process_run_queues kernel_process_queue;
 extern process_scheduler kernel_process_scheduler[NCPU];
 
 #endif //PROC_SCHEDULER_H
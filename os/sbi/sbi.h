@@ -19,5 +19,6 @@ int sbi_console_getchar();
 extern "C" __attribute__((noreturn)) void shutdown();
 void set_timer(uint64 stime);
 void start_hart(uint64 hartid, uint64 start_addr, uint64 a1);
+void send_ipi(uint64 hart_mask);
 
 #endif // SBI_H
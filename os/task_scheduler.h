@@ -6,33 +6,174 @@
 #include <utils/wait_queue.h>
 #include <deque>
 
-task<void> __task_executor(promise<void>* p);
+// counters of a task_queue, updated under its lock
+struct task_queue_stats {
+    uint64 pushes = 0;
+    uint64 pops = 0;
+    uint32 max_depth = 0;
+};
+
+// counters of a task_scheduler, written by the scheduler itself only.
+// the per-second window is taken by the process scheduler of the same core
+// (see sample_stats), so readers may see slightly stale numbers but never
+// race with another writer
+struct executor_stats {
+    static constexpr int LATENCY_BUCKETS = 16;
 
+    uint64 tasks_run = 0;
+    uint64 steals = 0;
+    uint64 idle_rounds = 0;  // found nothing to run
+    uint64 parks = 0;        // went to wfi
+    uint64 coop_yields = 0;  // awaits sent back to a queue by coop budget on this core
+    uint64 resume_cycles = 0; // time spent inside t.resume()
+    // local queue depth, sampled each time we run a task
+    uint64 depth_sum = 0;
+    uint32 depth_max = 0;
+    // wake-to-run latency, bucket i counts [2^i, 2^(i+1)) us, bucket 0 also counts 0 us
+    uint64 wake_latency[LATENCY_BUCKETS] {};
+
+    void add_depth(uint32 depth) {
+        depth_sum += depth;
+        if (depth > depth_max) {
+            depth_max = depth;
+        }
+    }
+
+    void add_latency(uint64 us) {
+        int i = us ? 63 - __builtin_clzl(us) : 0;
+        wake_latency[i < LATENCY_BUCKETS ? i : LATENCY_BUCKETS - 1]++;
+    }
+
+    // counters since prev, depth_max is kept as is
+    executor_stats since(const executor_stats& prev) const;
+    void print(int core_id) const;
+};
+
+// one deque for each priority, critical tasks are always popped first,
+// background tasks get one of every BACKGROUND_WEIGHT pops when there
+// are normal tasks
 class task_queue {
     // list<task_base> queue;
-    std::deque<task_base> queue;
+    std::deque<task_base> queue[TASK_PRIORITY_COUNT];
     spinlock lock {"task_queue.lock"};
     wait_queue wait_task_queue;
+    uint32 pop_count = 0;
+    task_queue_stats stats;
+
+    task_base __pop();
 
 public:
+    static constexpr uint32 BACKGROUND_WEIGHT = 8;
+
     task_base pop();
     task_base try_pop();
+    // pop up to max tasks with one lock acquisition, the first one follows
+    // the priority rules above, the others are normal tasks only.
+    // we take fewer when the queue is shallow, so other cores get their share
+    uint32 try_pop_batch(promise_base** batch, uint32 max);
     void push(task_base&& proc);
+    void push_batch(promise_base* const* batch, uint32 n);
     bool empty() { 
-        return queue.empty();
+        for (auto& q : queue) {
+            if (!q.empty()) {
+                return false;
+            }
+        }
+        return true;
+    }
+    // hint only, without lock
+    bool has_critical() {
+        return !queue[(int)task_priority::critical].empty();
     }
     int32 size() {
-        return queue.size();
+        int32 ret = 0;
+        for (auto& q : queue) {
+            ret += q.size();
+        }
+        return ret;
+    }
+    task_queue_stats get_stats() {
+        auto guard = make_lock_guard(lock);
+        return stats;
+    }
+
+};
+
+
+// per-core run queue, a bounded ring of promises (tasks in queue never own
+// their coroutine). only the owner core pushes, the owner and thieves from
+// other cores pop by CAS on head, so no lock is taken on either side.
+// owner side operations should be called with local irq disabled, because
+// interrupt handlers on the owner core may push too.
+class local_task_queue : noncopyable {
+   public:
+    static constexpr uint32 CAPACITY = 256;
+
+    // owner only, return false if full
+    bool push(promise_base* p);
+    // owner only
+    promise_base* pop();
+    // owner only, move first half of tasks into batch, return count
+    uint32 pop_half(promise_base** batch);
+    // owner only, steal half of victim's tasks into this queue,
+    // return one of them to run directly
+    promise_base* steal_from(local_task_queue& victim);
+
+    uint32 size() const {
+        return __atomic_load_n(&tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&head, __ATOMIC_ACQUIRE);
     }
-    
+    bool empty() const { return size() == 0; }
+
+   private:
+    uint32 head = 0; // consumers (owner and thieves)
+    uint32 tail = 0; // producer (owner)
+    promise_base* slots[CAPACITY] {};
 };
 
 
 struct task_scheduler {
     // std::deque<task_base> task_queue;
-    task_queue* _task_queue;
+    task_queue* _task_queue; // shared by all schedulers, also takes local overflow
+    task_queue remote_queue; // tasks pushed to us from other cores
+    local_task_queue local_queue;
+    int core_id = -1; // owner core, -1 means we only use _task_queue
+    uint32 schedule_tick = 0;
+
+    // the most recently woken task on this core runs next (written by owner only),
+    // but at most RUN_NEXT_LIMIT times in a row, so that two tasks waking each
+    // other cannot starve the queue
+    static constexpr uint32 RUN_NEXT_LIMIT = 8;
+    promise_base* run_next = nullptr;
+    uint32 run_next_streak = 0;
+
+    // local queue only holds normal tasks, we look at other queues for
+    // background tasks once every BACKGROUND_WEIGHT local pops
+    uint32 local_pop_count = 0;
+
+    // max tasks moved from a shared or remote queue into local queue at once
+    static constexpr uint32 POP_BATCH = 32;
+    // max root tasks pushed with one lock acquisition in schedule_batch
+    static constexpr uint32 SCHEDULE_BATCH = 64;
+
+    // we are waiting in wfi for an ipi
+    static constexpr uint32 PARK_AFTER_IDLE = 4;
+    bool parked = false;
+    // start() returns when out of tasks, and we never steal (private schedulers of tests)
     bool return_on_idle = false;
 
+    // bumped each time a resume returns, so others can tell whether the
+    // task they saw running on this core is still running (coro_mutex spin)
+    uint64 resume_seq = 0;
+
+    executor_stats stats;
+    executor_stats last_second; // stats of the last sample window
+    executor_stats __prev_stats;
+
+    void schedule(task_base&& h, task_priority priority) {
+        h.set_priority(priority);
+        schedule(std::move(h));
+    }
+
     void schedule(task_base&& h) {
         // let them clear themselves on final_suspend
         if(!h){
@@ -41,15 +182,7 @@ struct task_scheduler {
 
         // task_base tb;
 
-        // scheduler takes ownership of the coroutine whose caller is empty
-        if(!h.get_promise()->caller){
-            // we wrap the task with a task_executor
-            task_base buf = std::move(h); // take the ownership of the coroutine
-            buf.clear_owner();
-            auto task = __task_executor((promise<void>*)buf.get_promise());
-            task.clear_owner();
-            h = std::move(task);
-        }
+        __detach_root(h);
 
         h.clear_owner();
 
@@ -57,20 +190,64 @@ struct task_scheduler {
 
     }
 
-    void __schedule(task_base&& h) {
-        h.clear_owner();
-        task_base buf = std::move(h);
-        buf.get_promise()->self_scheduler = this;
-        _task_queue->push(std::move(buf));
-    }
+    // schedule n tasks, taking the queue lock once for every SCHEDULE_BATCH
+    // of them, tasks are moved out of the array
+    void schedule_batch(task_base* tasks, uint32 n);
+
+    // wakeup: put it into run_next slot if we are on the owner core,
+    // unless it is a background task
+    void __schedule(task_base&& h, bool wakeup = false);
 
-    bool is_free() { return _task_queue->empty(); }
+    bool is_free() {
+        return !__atomic_load_n(&run_next, __ATOMIC_ACQUIRE) &&
+            local_queue.empty() && remote_queue.empty() && _task_queue->empty();
+    }
 
     void start();
 
     void set_queue(task_queue* q) {
         _task_queue = q;
     }
+
+    void set_core(int id) {
+        core_id = id;
+    }
+
+    // wake up one parked scheduler if any, called after pushing shared work
+    static void wake_any();
+
+    executor_stats get_stats() const { return stats; }
+    uint64 get_resume_seq() const { return __atomic_load_n(&resume_seq, __ATOMIC_ACQUIRE); }
+    executor_stats get_last_second() const { return last_second; }
+
+    // called once per second by the process scheduler of our core
+    void sample_stats();
+
+    // print stats of all per-core schedulers and the shared queue
+    static void print_stats();
+
+    private:
+    // scheduler takes ownership of the coroutine whose caller is empty,
+    // it destroys itself on final_suspend and logs if it failed
+    static void __detach_root(task_base& h) {
+        promise_base* p = h.get_promise();
+        if(!p->caller){
+            p->detached = true;
+        }
+    }
+
+    task_base __next_task();
+    task_base __pop_batch(task_queue& q);
+    task_base __steal();
+    task_base __take_run_next();
+    task_base __pop_shared();
+    void __push_overflow(promise_base* p);
+    void __park();
+    bool __wake_parked();
+    bool __has_stealable();
+
+    // owner only, irq disabled
+    promise_base* overflow_buffer[local_task_queue::CAPACITY / 2 + 1];
 };
 
 
@@ -0,0 +1,187 @@
+#ifndef TEST_COROUTINE_MUTEX_HPP
+#define TEST_COROUTINE_MUTEX_HPP
+
+#include <test/test.h>
+
+#include <utils/wait_queue.h>
+#include <atomic/spinlock.h>
+#include <atomic/mutex.h>
+#include <ccore/types.h>
+
+#include <coroutine.h>
+#include <task_scheduler.h>
+
+#include <proc/process.h>
+#include <proc/scheduler.h>
+
+namespace test {
+
+namespace coroutine {
+
+void __function_caller_test_mutex(void* arg);
+
+// too large for a kernel stack
+static task_scheduler __test_mutex_scheduler;
+static task_queue __test_mutex_queue;
+
+// first on a private scheduler of our core (see test_scheduler): waiters
+// next to a suspended holder park, and get the mutex in the order they
+// came, nobody takes it while it is handed over.
+// then ntasks on all kernel executors take it rounds times each, some
+// suspend while holding it so others park, others spin on a running holder.
+// the mutex is never held twice, and no waiter is left behind
+class test_mutex : public test_base {
+private:
+    static constexpr uint32 NWAITERS = 5;
+
+    uint64 ntasks;
+    uint64 rounds;
+
+    single_wait_queue _wait_queue;
+    spinlock lock;
+    bool bound_done = false;
+    bool bound_ok = false;
+    uint32 subtask_complete;
+    uint32 subtask_total;
+
+    coro_mutex mutex {"test_mutex.mutex"};
+    uint32 seq = 0;
+    uint32 order[NWAITERS] {};
+    bool handed_over_taken = false;
+
+    bool inside = false;
+    bool overlapped = false;
+    uint64 count = 0;
+
+public:
+    test_mutex(uint64 ntasks = 64, uint64 rounds = 100) {
+        this->ntasks = ntasks;
+        this->rounds = rounds;
+    }
+
+    bool run() override {
+        auto self = this;
+        shared_ptr<::process> proc = make_shared<kernel_process>(kernel_process_queue.alloc_pid(), __function_caller_test_mutex, &self, sizeof(self));
+        proc->set_name("test_mutex");
+        proc->binding_core = cpu::current_id();
+        kernel_process_queue.push(proc);
+
+        lock.lock();
+        while (!bound_done) {
+            cpu::my_cpu()->sleep(&_wait_queue, lock);
+        }
+        lock.unlock();
+        if (!bound_ok) {
+            return false;
+        }
+
+        subtask_total = ntasks;
+        subtask_complete = 0;
+        for (uint32 i = 0; i < ntasks; i++) {
+            kernel_task_scheduler[i % NCPU].schedule(contender());
+        }
+        lock.lock();
+        while (subtask_complete != subtask_total) {
+            cpu::my_cpu()->sleep(&_wait_queue, lock);
+        }
+        lock.unlock();
+
+        print();
+        __expect(overlapped, false);
+        __expect(count, ntasks * rounds);
+        return true;
+    }
+
+    void print() override {
+        infof("test_mutex: %l tasks, %l rounds each, count %l", ntasks, rounds, count);
+    }
+
+public:
+    void bound() {
+        bool result = test_fifo();
+
+        lock.lock();
+        bound_done = true;
+        bound_ok = result;
+        lock.unlock();
+        _wait_queue.wake_up();
+    }
+
+private:
+    task<void> holder() {
+        co_await mutex.lock();
+        // the waiters queue up behind us
+        co_await this_scheduler;
+        mutex.unlock();
+        // it is the first waiter's now, though it has not run yet
+        handed_over_taken = mutex.try_lock();
+        co_return task_ok;
+    }
+
+    task<void> waiter(uint32 i) {
+        co_await mutex.lock();
+        order[i] = seq++;
+        mutex.unlock();
+        co_return task_ok;
+    }
+
+    bool test_fifo() {
+        task_scheduler& s = __test_mutex_scheduler;
+        s.set_queue(&__test_mutex_queue);
+        s.set_core(cpu::current_id());
+        s.return_on_idle = true;
+
+        s.schedule(holder());
+        for (uint32 i = 0; i < NWAITERS; i++) {
+            s.schedule(waiter(i));
+        }
+        s.start();
+
+        __expect(handed_over_taken, false);
+        __expect(seq, NWAITERS);
+        for (uint32 i = 0; i < NWAITERS; i++) {
+            __expect(order[i], i);
+        }
+        __expect(mutex.try_lock(), true);
+        mutex.unlock();
+        return true;
+    }
+
+    task<void> contender() {
+        for (uint32 i = 0; i < rounds; i++) {
+            co_await mutex.lock();
+            if (__atomic_exchange_n(&inside, true, __ATOMIC_ACQ_REL)) {
+                overlapped = true;
+            }
+            count++;
+            if (i % 4 == 0) {
+                co_await this_scheduler;
+            }
+            __atomic_store_n(&inside, false, __ATOMIC_RELEASE);
+            mutex.unlock();
+        }
+        subtask_done();
+        co_return task_ok;
+    }
+
+    void subtask_done() {
+        lock.lock();
+        subtask_complete++;
+        if (subtask_complete == subtask_total) {
+            _wait_queue.wake_up();
+        }
+        lock.unlock();
+    }
+
+}; // class test_mutex
+
+void __function_caller_test_mutex(void* arg) {
+    test_mutex* test = *(test_mutex**)arg;
+    test->bound();
+}
+
+} // namespace coroutine
+
+} // namespace test
+
+#endif
@@ -0,0 +1,233 @@
+#ifndef TEST_COROUTINE_SCHEDULER_HPP
+#define TEST_COROUTINE_SCHEDULER_HPP
+
+#include <test/test.h>
+
+#include <utils/wait_queue.h>
+#include <atomic/spinlock.h>
+#include <ccore/types.h>
+
+#include <coroutine.h>
+#include <task_scheduler.h>
+
+#include <proc/process.h>
+#include <proc/scheduler.h>
+
+namespace test {
+
+namespace coroutine {
+
+void __function_caller_test_scheduler(void* arg);
+
+// too large for a kernel stack
+static local_task_queue __test_ring;
+static local_task_queue __test_victim;
+static task_scheduler __test_scheduler;
+static task_queue __test_shared_queue;
+
+// the ring on its own, then a private scheduler owned by a real core, so
+// that the owner paths (overflow, run_next) are taken. the scheduler part
+// runs in a process bound to our core, it returns on idle and never steals
+// from the kernel schedulers, so the order of tasks is deterministic
+class test_scheduler : public test_base {
+private:
+    single_wait_queue _wait_queue;
+    spinlock lock;
+    bool done = false;
+    bool ok = false;
+
+    uint32 seq = 0;
+
+public:
+    bool run() override {
+        if (!test_ring()) {
+            return false;
+        }
+
+        auto self = this;
+        shared_ptr<::process> proc = make_shared<kernel_process>(kernel_process_queue.alloc_pid(), __function_caller_test_scheduler, &self, sizeof(self));
+        proc->set_name("test_scheduler");
+        proc->binding_core = cpu::current_id();
+        kernel_process_queue.push(proc);
+
+        lock.lock();
+        while (!done) {
+            cpu::my_cpu()->sleep(&_wait_queue, lock);
+        }
+        lock.unlock();
+
+        print();
+        return ok;
+    }
+
+    void print() override {
+        infof("test_scheduler: %s", ok ? "ok" : "fail");
+    }
+
+public:
+    void bound() {
+        bool result = test_overflow() && test_run_next();
+
+        lock.lock();
+        done = true;
+        ok = result;
+        lock.unlock();
+        _wait_queue.wake_up();
+    }
+
+private:
+    // never dereferenced, only compared
+    static promise_base* __fake(uint32 i) {
+        return (promise_base*)(uint64)((i + 1) * 8);
+    }
+
+    bool test_ring() {
+        local_task_queue& q = __test_ring;
+        constexpr uint32 N = local_task_queue::CAPACITY;
+
+        // start off slot 0, so filling it up wraps around the end
+        for (uint32 i = 0; i < 5; i++) {
+            __expect(q.push(__fake(i)), true);
+            __expect(q.pop() == __fake(i), true);
+        }
+        for (uint32 round = 0; round < 3; round++) {
+            for (uint32 i = 0; i < N; i++) {
+                __expect(q.push(__fake(round * N + i)), true);
+            }
+            __expect(q.push(__fake(0)), false);
+            __expect(q.size(), N);
+            for (uint32 i = 0; i < N; i++) {
+                __expect(q.pop() == __fake(round * N + i), true);
+            }
+            __expect(q.pop() == nullptr, true);
+        }
+
+        // pop_half takes the oldest half
+        promise_base* batch[8];
+        for (uint32 i = 0; i < 10; i++) {
+            q.push(__fake(i));
+        }
+        __expect(q.pop_half(batch), 5u);
+        for (uint32 i = 0; i < 5; i++) {
+            __expect(batch[i] == __fake(i), true);
+        }
+        for (uint32 i = 5; i < 10; i++) {
+            __expect(q.pop() == __fake(i), true);
+        }
+        __expect(q.empty(), true);
+
+        // steal the oldest half, the newest of them is returned to run
+        local_task_queue& v = __test_victim;
+        for (uint32 i = 0; i < 10; i++) {
+            v.push(__fake(i));
+        }
+        __expect(q.steal_from(v) == __fake(4), true);
+        __expect(q.size(), 4u);
+        __expect(v.size(), 5u);
+        for (uint32 i = 0; i < 4; i++) {
+            __expect(q.pop() == __fake(i), true);
+        }
+        for (uint32 i = 5; i < 10; i++) {
+            __expect(v.pop() == __fake(i), true);
+        }
+        __expect(q.steal_from(v) == nullptr, true);
+
+        // no room, nothing taken
+        for (uint32 i = 0; i < N; i++) {
+            q.push(__fake(i));
+        }
+        v.push(__fake(0));
+        v.push(__fake(1));
+        __expect(q.steal_from(v) == nullptr, true);
+        __expect(v.size(), 2u);
+        while (q.pop()) {}
+        while (v.pop()) {}
+        return true;
+    }
+
+    task<void> record(uint32* at) {
+        if (at) {
+            *at = seq;
+        }
+        seq++;
+        co_return task_ok;
+    }
+
+    // a full local queue moves half of it to the shared queue, a critical
+    // task goes to the remote queue and runs first, nothing is lost
+    bool test_overflow() {
+        task_scheduler& s = __test_scheduler;
+        constexpr uint32 N = local_task_queue::CAPACITY;
+        s.set_queue(&__test_shared_queue);
+        s.set_core(cpu::current_id());
+        s.return_on_idle = true;
+
+        seq = 0;
+        uint32 total = N + N / 2;
+        for (uint32 i = 0; i < total; i++) {
+            s.schedule(record(nullptr));
+        }
+        // the one that did not fit goes with the older half
+        __expect(__test_shared_queue.size(), (int32)(N / 2 + 1));
+        __expect(s.local_queue.size(), total - (N / 2 + 1));
+
+        uint32 critical_at = ~0u;
+        s.schedule(record(&critical_at), task_priority::critical);
+        __expect(s.remote_queue.size(), 1);
+
+        s.start();
+        __expect(critical_at, 0u);
+        __expect(seq, total + 1);
+        __expect(s.is_free(), true);
+        return true;
+    }
+
+    // run it again at once, as a wakeup on the owner core does
+    struct wake_self_awaiter {
+        bool await_ready() { return false; }
+        void await_suspend(task_base h) { h.wake_up(); }
+        void await_resume() {}
+    };
+
+    task<void> wake_self(uint32* rounds, uint32 n) {
+        for (uint32 i = 0; i < n; i++) {
+            (*rounds)++;
+            co_await wake_self_awaiter{};
+        }
+        co_return task_ok;
+    }
+
+    task<void> see_rounds(uint32* rounds, uint32* seen) {
+        *seen = *rounds;
+        co_return task_ok;
+    }
+
+    // a woken task runs next, but at most RUN_NEXT_LIMIT times in a row,
+    // then the local queue gets its turn
+    bool test_run_next() {
+        task_scheduler& s = __test_scheduler;
+        uint32 rounds = 0;
+        uint32 seen = 0;
+        s.schedule(wake_self(&rounds, 50));
+        s.schedule(see_rounds(&rounds, &seen));
+
+        s.start();
+        // once from the local queue, then from run_next
+        __expect(seen, task_scheduler::RUN_NEXT_LIMIT + 1);
+        __expect(rounds, 50u);
+        __expect(s.is_free(), true);
+        return true;
+    }
+
+}; // class test_scheduler
+
+void __function_caller_test_scheduler(void* arg) {
+    test_scheduler* test = *(test_scheduler**)arg;
+    test->bound();
+}
+
+} // namespace coroutine
+
+} // namespace test
+
+#endif
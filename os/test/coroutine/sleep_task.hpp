@@ -88,8 +88,12 @@ private:
     
         set_subtask(ntasks);
         tr.record_timestamp("create start");
-        for (uint32 i = 0; i < ntasks; i++) {
-            kernel_task_scheduler[0].schedule(std::move(subtask(random())));
+        for (uint32 i = 0; i < ntasks; ) {
+            uint32 n = 0;
+            for (; n < task_scheduler::SCHEDULE_BATCH && i < ntasks; n++, i++) {
+                spawn_buffer[n] = subtask(random());
+            }
+            kernel_task_scheduler[0].schedule_batch(spawn_buffer, n);
         }
         tr.record_timestamp("create done");
         co_await subtask_all_done();
@@ -162,6 +166,7 @@ private:
 
     private:
     uint64 dummy = 0;
+    task_base spawn_buffer[task_scheduler::SCHEDULE_BATCH];
 
 };
 
@@ -109,7 +109,8 @@ class test_shell : public test_base {
 
             rawf("name inode size nlinks perm type");
             int count = 0;
-            while (auto _dentry = *co_await dir_iterator) {
+            while (auto next = co_await dir_iterator) {
+                auto& _dentry = *next;
                 auto _inode = _dentry->get_inode();
                 auto _inode_ref = *co_await _inode->get_ref();
                 auto metadata = *co_await _inode_ref->get_metadata();
@@ -349,6 +350,16 @@ class test_shell : public test_base {
         co_await cwd->get_inode()->link(src_dentry, file_dentry);
     }
 
+    // trace on|off|clear|dump, dump prints chrome trace json
+    void do_trace(std::string_view& line) {
+        auto op = get_token(line);
+        if (op == "on")         kernel_task_tracer.enable();
+        else if (op == "off")   kernel_task_tracer.disable();
+        else if (op == "clear") kernel_task_tracer.clear();
+        else if (op == "dump")  kernel_task_tracer.dump();
+        else rawf("trace: %s, usage: trace on|off|clear|dump", kernel_task_tracer.is_enabled() ? "on" : "off");
+    }
+
     task<void> do_cd(std::string_view& line) {
         // change dir
         auto _dentry = *co_await get_dentry(line);
@@ -417,7 +428,9 @@ class test_shell : public test_base {
             else if (cmd == "link")    CO_AWAIT_NOFAIL(do_link(line_view));
             else if (cmd == "cd")      CO_AWAIT_NOFAIL(do_cd(line_view));
             else if (cmd == "test_bigfile")      CO_AWAIT_NOFAIL(test_bigfile(line_view));
-            else if (cmd == "help")    rawf("Commands: ls, mkfs, mount, unmount, cat, append, write, touch, mkdir, unlink, link, cd, help, exit");
+            else if (cmd == "trace")   do_trace(line_view);
+            else if (cmd == "stats")   task_scheduler::print_stats();
+            else if (cmd == "help")    rawf("Commands: ls, mkfs, mount, unmount, cat, append, write, touch, mkdir, unlink, link, cd, trace, stats, help, exit");
                 
             else if (cmd == "exit") break;
             else rawf("Unknown command: %s", CSTR(cmd));
@@ -451,7 +464,10 @@ class test_shell : public test_base {
 
     bool run() override {
 
-        push_task(shell());
+        auto t = shell();
+        // every command goes down a deep await chain, keep its frames in an arena
+        t.use_frame_arena();
+        push_task(t);
 
 
         real_test_lock.lock();
@@ -0,0 +1,129 @@
+#ifndef TEST_PROCESS_FIFO_LATENCY_HPP
+#define TEST_PROCESS_FIFO_LATENCY_HPP
+
+#include <test/test.h>
+
+#include <utils/wait_queue.h>
+#include <atomic/spinlock.h>
+#include <ccore/types.h>
+
+#include <arch/timer.h>
+
+#include <proc/process.h>
+#include <proc/scheduler.h>
+
+namespace test {
+
+namespace process {
+
+void __function_caller_fifo_sleeper(void* arg);
+void __function_caller_cpu_hog(void* arg);
+
+// a fifo process sleeps again and again next to cpu bound stride processes,
+// reports how late it is back after each deadline. wall clock dependent,
+// a benchmark, not a pass/fail test
+class test_fifo_latency : public test_base {
+private:
+    uint64 nhogs;
+    uint64 rounds;
+
+    single_wait_queue _wait_queue;
+    uint32 subtask_complete;
+    uint32 subtask_total;
+    spinlock lock;
+
+    bool sleeper_done = false;
+    uint64 max_late = 0; // ticks
+    uint64 total_late = 0;
+
+public:
+    test_fifo_latency(uint64 nhogs = 4, uint64 rounds = 100) {
+        this->nhogs = nhogs;
+        this->rounds = rounds;
+    }
+
+    bool run() override {
+        subtask_total = nhogs + 1;
+        subtask_complete = 0;
+
+        auto self = this;
+        for (uint32 i = 0; i < nhogs; i++) {
+            shared_ptr<::process> hog = make_shared<kernel_process>(kernel_process_queue.alloc_pid(), __function_caller_cpu_hog, &self, sizeof(self));
+            hog->set_name("cpu_hog");
+            kernel_process_queue.push(hog);
+        }
+
+        shared_ptr<::process> sleeper = make_shared<kernel_process>(kernel_process_queue.alloc_pid(), __function_caller_fifo_sleeper, &self, sizeof(self));
+        sleeper->set_name("fifo_sleeper");
+        sleeper->policy = sched_policy::fifo;
+        sleeper->rt_priority = 1;
+        kernel_process_queue.push(sleeper);
+
+        lock.lock();
+        while (subtask_complete != subtask_total) {
+            cpu::my_cpu()->sleep(&_wait_queue, lock);
+        }
+        lock.unlock();
+
+        print();
+        return true;
+    }
+
+    void print() {
+        infof("fifo latency: avg %l us, max %l us over %l rounds",
+              timer::TICK_TO_US(total_late / rounds), timer::TICK_TO_US(max_late), rounds);
+    }
+
+public:
+    void sleeper() {
+        for (uint64 i = 0; i < rounds; i++) {
+            uint64 deadline = r_time() + timer::MS_TO_TICK(1);
+            cpu::my_cpu()->sleep(timer::MS_TO_TICK(1));
+            uint64 late = r_time() - deadline;
+            total_late += late;
+            if (late > max_late) {
+                max_late = late;
+            }
+        }
+        __atomic_store_n(&sleeper_done, true, __ATOMIC_RELEASE);
+        subtask_done();
+    }
+
+    void cpu_hog() {
+        uint64 result = 0;
+        while (!__atomic_load_n(&sleeper_done, __ATOMIC_ACQUIRE)) {
+            result += result * 1103515245 + 12345;
+        }
+        dummy += result;
+        subtask_done();
+    }
+
+private:
+    void subtask_done() {
+        lock.lock();
+        subtask_complete++;
+        if (subtask_complete == subtask_total) {
+            _wait_queue.wake_up();
+        }
+        lock.unlock();
+    }
+
+    uint64 dummy = 0;
+
+}; // class test_fifo_latency
+
+void __function_caller_fifo_sleeper(void* arg) {
+    test_fifo_latency* test = *(test_fifo_latency**)arg;
+    test->sleeper();
+}
+
+void __function_caller_cpu_hog(void* arg) {
+    test_fifo_latency* test = *(test_fifo_latency**)arg;
+    test->cpu_hog();
+}
+
+} // namespace process
+
+} // namespace test
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef TEST_PROCESS_RUN_QUEUES_HPP
+#define TEST_PROCESS_RUN_QUEUES_HPP
+
+#include <test/test.h>
+
+#include <utils/wait_queue.h>
+#include <atomic/spinlock.h>
+#include <ccore/types.h>
+
+#include <arch/cpu.h>
+#include <arch/timer.h>
+
+#include <proc/process.h>
+#include <proc/scheduler.h>
+
+namespace test {
+
+namespace process {
+
+void __function_caller_bound(void* arg);
+void __function_caller_unbound_hog(void* arg);
+
+// never queued in kernel_process_queue, these processes do not run
+static process_run_queues __test_run_queues;
+
+// first on run queues of our own, with processes that never run: a bound
+// process is never pulled by another core, a woken one goes back to the
+// core it ran on (or is bound to) with a stride no lower than the others
+// there. then live: bound processes check where they are while unbound
+// hogs keep the balancer busy
+class test_run_queues : public test_base {
+private:
+    uint64 nhogs;
+    uint64 rounds;
+
+    single_wait_queue _wait_queue;
+    uint32 subtask_complete;
+    uint32 subtask_total;
+    spinlock lock;
+
+    bool bound_done = false;
+    bool migrated = false;
+    uint64 dummy = 0;
+
+public:
+    struct bound_arg {
+        test_run_queues* test;
+        int core;
+    };
+
+    test_run_queues(uint64 nhogs = 4, uint64 rounds = 50) {
+        this->nhogs = nhogs;
+        this->rounds = rounds;
+    }
+
+    bool run() override {
+        if (!test_pull() || !test_wake_up()) {
+            return false;
+        }
+
+        uint32 nbound = 0;
+        for (int i = 0; i < NCPU; i++) {
+            if (cpus[i].is_booted() && !cpus[i].is_executor_only()) {
+                nbound++;
+            }
+        }
+        subtask_total = nbound + nhogs;
+        subtask_complete = 0;
+        bound_left = nbound;
+
+        auto self = this;
+        for (uint32 i = 0; i < nhogs; i++) {
+            shared_ptr<::process> hog = make_shared<kernel_process>(kernel_process_queue.alloc_pid(), __function_caller_unbound_hog, &self, sizeof(self));
+            hog->set_name("unbound_hog");
+            kernel_process_queue.push(hog);
+        }
+        for (int i = 0; i < NCPU; i++) {
+            if (!cpus[i].is_booted() || cpus[i].is_executor_only()) {
+                continue;
+            }
+            bound_arg arg {this, i};
+            shared_ptr<::process> p = make_shared<kernel_process>(kernel_process_queue.alloc_pid(), __function_caller_bound, &arg, sizeof(arg));
+            p->set_name("bound");
+            p->binding_core = i;
+            kernel_process_queue.push(p);
+        }
+
+        lock.lock();
+        while (subtask_complete != subtask_total) {
+            cpu::my_cpu()->sleep(&_wait_queue, lock);
+        }
+        lock.unlock();
+
+        print();
+        __expect(migrated, false);
+        return true;
+    }
+
+    void print() override {
+        infof("test_run_queues: %l bound rounds next to %l hogs, %s", rounds, nhogs, migrated ? "migrated" : "ok");
+    }
+
+public:
+    // sleeps and slices, each of them may move an unbound process
+    void bound(int core) {
+        for (uint64 i = 0; i < rounds; i++) {
+            uint64 until = r_time() + timer::MS_TO_TICK(2);
+            while (r_time() < until) {
+                check_core(core);
+            }
+            cpu::my_cpu()->sleep(timer::MS_TO_TICK(1));
+            check_core(core);
+        }
+        lock.lock();
+        if (--bound_left == 0) {
+            __atomic_store_n(&bound_done, true, __ATOMIC_RELEASE);
+        }
+        lock.unlock();
+        subtask_done();
+    }
+
+    void unbound_hog() {
+        uint64 result = 0;
+        while (!__atomic_load_n(&bound_done, __ATOMIC_ACQUIRE)) {
+            result += result * 1103515245 + 12345;
+        }
+        dummy += result;
+        subtask_done();
+    }
+
+private:
+    uint32 bound_left = 0;
+
+    void check_core(int core) {
+        if (cpu::current_id() != core) {
+            __atomic_store_n(&migrated, true, __ATOMIC_RELAXED);
+        }
+    }
+
+    void subtask_done() {
+        lock.lock();
+        subtask_complete++;
+        if (subtask_complete == subtask_total) {
+            _wait_queue.wake_up();
+        }
+        lock.unlock();
+    }
+
+    static void __never_run(void*) {}
+
+    static shared_ptr<::process> __make(int binding_core = -1) {
+        shared_ptr<::process> p = make_shared<kernel_process>(kernel_process_queue.alloc_pid(), __never_run);
+        p->binding_core = binding_core;
+        p->set_runnable();
+        return p;
+    }
+
+    // only an unbound process is pulled, it starts from the bottom of our strides
+    bool test_pull() {
+        process_run_queues& rq = __test_run_queues;
+        int me = cpu::current_id();
+        int other = (me + 1) % NCPU;
+
+        auto b1 = __make(other);
+        auto b2 = __make(other);
+        rq.push(b1);
+        rq.push(b2);
+        __expect(rq.queue(other).runnable(), 2u);
+        __expect(rq.pull(me) == nullptr, true);
+        __expect(rq.queue(other).runnable(), 2u);
+
+        auto u = __make();
+        u->stride = rq.queue(me).min_stride() + BIG_STRIDE / 4;
+        rq.queue(other).push(u);
+        __expect(rq.pull(me) == u, true);
+        __expect(u->stride, rq.queue(me).min_stride());
+        __expect(rq.pull(me) == nullptr, true);
+
+        while (rq.queue(other).pop()) {}
+        b1->kill();
+        b2->kill();
+        u->kill();
+        return true;
+    }
+
+    // sleeping, then woken up before it was parked, it is not in any queue
+    static void __sleep_and_wake(shared_ptr<::process> p) {
+        p->try_start();
+        p->sleep();
+        p->wake_up();
+    }
+
+    // back to the core it ran on, or the one it is bound to, never behind
+    // the strides there
+    bool test_wake_up() {
+        process_run_queues& rq = __test_run_queues;
+        int me = cpu::current_id();
+        int other = (me + 1) % NCPU;
+
+        auto r = __make();
+        r->stride = 5000;
+        rq.queue(other).push(r);
+        __expect(rq.queue(other).pop() == r, true);
+        __expect(rq.queue(other).min_stride(), 5000ul);
+
+        auto w = __make();
+        w->stride = 10;
+        w->last_core = other;
+        __sleep_and_wake(w);
+        rq.wake_up(w);
+        __expect(rq.queue(other).runnable(), 1u);
+        __expect(rq.queue(me).runnable(), 0u);
+        __expect(w->stride, 5000ul);
+
+        auto wb = __make(me);
+        wb->last_core = other;
+        __sleep_and_wake(wb);
+        rq.wake_up(wb);
+        __expect(rq.queue(me).runnable(), 1u);
+        __expect(rq.queue(other).runnable(), 1u);
+
+        __expect(rq.queue(other).pop() == w, true);
+        __expect(rq.queue(me).pop() == wb, true);
+        r->kill();
+        w->kill();
+        wb->kill();
+        return true;
+    }
+
+}; // class test_run_queues
+
+void __function_caller_bound(void* arg) {
+    test_run_queues::bound_arg* a = (test_run_queues::bound_arg*)arg;
+    a->test->bound(a->core);
+}
+
+void __function_caller_unbound_hog(void* arg) {
+    test_run_queues* test = *(test_run_queues**)arg;
+    test->unbound_hog();
+}
+
+} // namespace process
+
+} // namespace test
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef TEST_PROCESS_WAKE_UP_HPP
+#define TEST_PROCESS_WAKE_UP_HPP
+
+#include <test/test.h>
+
+#include <utils/wait_queue.h>
+#include <atomic/spinlock.h>
+#include <ccore/types.h>
+
+#include <arch/cpu.h>
+
+#include <proc/process.h>
+#include <proc/scheduler.h>
+
+namespace test {
+
+namespace process {
+
+void __function_caller_ping(void* arg);
+void __function_caller_pong(void* arg);
+
+// never queued in kernel_process_queue, these processes do not run
+static process_queue __test_wake_queue;
+
+// a sleeping process is parked when the scheduler puts it back, unless
+// wake_up came first: then it is WAKEN_UP with nobody to queue it but the
+// scheduler, which must run it. first step by step on a queue of our own,
+// then two processes wake each other rounds times, on different cores the
+// wake up often lands before the other one is parked. a lost one hangs here
+class test_wake_up : public test_base {
+private:
+    uint64 rounds;
+
+    single_wait_queue _wait_queue;
+    uint32 subtask_complete;
+    uint32 subtask_total;
+    spinlock lock;
+
+    spinlock turn_lock;
+    single_wait_queue turn_queue[2];
+    uint32 turn = 0;
+
+public:
+    test_wake_up(uint64 rounds = 10000) {
+        this->rounds = rounds;
+    }
+
+    bool run() override {
+        if (!test_park()) {
+            return false;
+        }
+
+        subtask_total = 2;
+        subtask_complete = 0;
+
+        auto self = this;
+        shared_ptr<::process> ping = make_shared<kernel_process>(kernel_process_queue.alloc_pid(), __function_caller_ping, &self, sizeof(self));
+        ping->set_name("ping");
+        kernel_process_queue.push(ping);
+        shared_ptr<::process> pong = make_shared<kernel_process>(kernel_process_queue.alloc_pid(), __function_caller_pong, &self, sizeof(self));
+        pong->set_name("pong");
+        kernel_process_queue.push(pong);
+
+        lock.lock();
+        while (subtask_complete != subtask_total) {
+            cpu::my_cpu()->sleep(&_wait_queue, lock);
+        }
+        lock.unlock();
+
+        print();
+        __expect(turn, (uint32)(rounds * 2));
+        return true;
+    }
+
+    void print() override {
+        infof("test_wake_up: %l rounds", rounds);
+    }
+
+public:
+    // even turns are ping's, odd ones pong's
+    void player(uint32 me) {
+        for (uint64 i = 0; i < rounds; i++) {
+            turn_lock.lock();
+            while (turn % 2 != me) {
+                cpu::my_cpu()->sleep(&turn_queue[me], turn_lock);
+            }
+            turn++;
+            turn_queue[1 - me].wake_up();
+            turn_lock.unlock();
+        }
+        subtask_done();
+    }
+
+private:
+    void subtask_done() {
+        lock.lock();
+        subtask_complete++;
+        if (subtask_complete == subtask_total) {
+            _wait_queue.wake_up();
+        }
+        lock.unlock();
+    }
+
+    static void __never_run(void*) {}
+
+    static shared_ptr<::process> __make_sleeping() {
+        shared_ptr<::process> p = make_shared<kernel_process>(kernel_process_queue.alloc_pid(), __never_run);
+        p->set_runnable();
+        p->try_start();
+        p->sleep();
+        return p;
+    }
+
+    bool test_park() {
+        process_queue& q = __test_wake_queue;
+
+        // in order: parked, in no queue, it holds itself until woken
+        auto parked = __make_sleeping();
+        q.push(parked);
+        __expect(q.runnable(), 0u);
+        __expect(parked->ready(), false);
+
+        // woken before the scheduler put it back, nobody has queued it
+        auto early = __make_sleeping();
+        early->wake_up();
+        __expect(early->waken_up(), true);
+        __expect(q.runnable(), 0u);
+        // put back, it is runnable and queued instead of parked
+        q.push(early);
+        __expect(q.runnable(), 1u);
+        __expect(q.pop() == early, true);
+        __expect(early->ready(), true);
+
+        // killed while parked, it lets go of itself and never comes back
+        parked->kill();
+        __expect(q.pop() == nullptr, true);
+        early->kill();
+        return true;
+    }
+
+}; // class test_wake_up
+
+void __function_caller_ping(void* arg) {
+    test_wake_up* test = *(test_wake_up**)arg;
+    test->player(0);
+}
+
+void __function_caller_pong(void* arg) {
+    test_wake_up* test = *(test_wake_up**)arg;
+    test->player(1);
+}
+
+} // namespace process
+
+} // namespace test
+
+#endif
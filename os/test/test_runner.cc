@@ -4,12 +4,20 @@
 #include <test/coroutine/alloc.hpp>
 #include <test/coroutine/sleep.hpp>
 #include <test/coroutine/sleep_task.hpp>
+#include <test/coroutine/scheduler.hpp>
+#include <test/coroutine/mutex.hpp>
 
 #include <test/process/sleep_task.hpp>
 #include <test/process/sleep.hpp>
+#include <test/process/fifo_latency.hpp>
+#include <test/process/run_queues.hpp>
+#include <test/process/wake_up.hpp>
 
 #include <test/nfs/shell.hpp>
 
+#include <test/utils/timer_wheel.hpp>
+#include <test/utils/keyed_wait_queue.hpp>
+
 void run_tests(void*) {
 
     // pt_malloc test
@@ -34,6 +42,24 @@ void run_tests(void*) {
     // test::coroutine::test_sleep test4(10);
     // test4.run();
 
+    test::utils::test_timer_wheel test8;
+    test8.run();
+
+    test::utils::test_keyed_wait_queue test11;
+    test11.run();
+
+    test::coroutine::test_scheduler test9;
+    test9.run();
+
+    test::coroutine::test_mutex test10(64, 100);
+    test10.run();
+
+    test::process::test_run_queues test12(4, 50);
+    test12.run();
+
+    test::process::test_wake_up test13(10000);
+    test13.run();
+
     test::coroutine::test_sleep_task test5(1000, 100000);
     test5.run();
     test5.print();
@@ -41,6 +67,9 @@ void run_tests(void*) {
     // test::process::test_sleep_task test5(1000, 100000);
     // test5.run();
     // test5.print();
+
+    // test::process::test_fifo_latency test7(4, 100);
+    // test7.run();
     debugf("done");
 
     // auto bdev = device::get<block_device>(virtio_disk_id);
@@ -0,0 +1,91 @@
+#ifndef TEST_UTILS_KEYED_WAIT_QUEUE_HPP
+#define TEST_UTILS_KEYED_WAIT_QUEUE_HPP
+
+#include <test/test.h>
+
+#include <utils/wait_queue.h>
+
+namespace test {
+
+namespace utils {
+
+// twice as many keys as buckets, so some keys share a bucket
+static constexpr uint32 __test_key_count = keyed_wait_queue::BUCKET_COUNT * 2;
+
+struct __test_counter : sleepable {
+    uint32 woken = 0;
+    void sleep() override {}
+    void wake_up() override { woken++; }
+};
+
+// too large for a kernel stack
+static keyed_wait_queue __test_keyed_queue;
+static __test_counter __test_keyed_sleepers[__test_key_count * 2];
+static keyed_wait_queue::node __test_keyed_nodes[__test_key_count * 2];
+
+// two waiters on each key: waking a key wakes its own waiters only, also
+// those next to it in the same bucket are left alone. waiters removed
+// before the wake up are never woken, and the others around them are
+class test_keyed_wait_queue : public test_base {
+    static uint64 key(uint32 i) {
+        return keyed_wait_queue::make_key(i, 7);
+    }
+
+    static bool removed(uint32 i, uint32 j) {
+        return j == 0 ? i % 3 == 0 : i % 5 == 0;
+    }
+
+public:
+    bool run() override {
+        keyed_wait_queue& q = __test_keyed_queue;
+        auto sleepers = __test_keyed_sleepers;
+        auto nodes = __test_keyed_nodes;
+
+        for (uint32 i = 0; i < __test_key_count; i++) {
+            for (uint32 j = 0; j < 2; j++) {
+                nodes[i * 2 + j].key = key(i);
+                nodes[i * 2 + j].sleeper = &sleepers[i * 2 + j];
+                q.sleep(&nodes[i * 2 + j]);
+            }
+        }
+
+        // the first, the last, or both waiters of a key
+        for (uint32 i = 0; i < __test_key_count; i++) {
+            for (uint32 j = 0; j < 2; j++) {
+                if (removed(i, j)) {
+                    __expect(q.remove(&nodes[i * 2 + j]), true);
+                    __expect(nodes[i * 2 + j].pending(), false);
+                    __expect(q.remove(&nodes[i * 2 + j]), false);
+                }
+            }
+        }
+
+        for (uint32 i = 0; i < __test_key_count; i++) {
+            uint32 expected = !removed(i, 0) + !removed(i, 1);
+            __expect(q.has_waiters(key(i)), expected != 0);
+            __expect(q.wake_up(key(i)), expected);
+            __expect(q.has_waiters(key(i)), false);
+
+            for (uint32 k = 0; k < __test_key_count * 2; k++) {
+                uint32 woken = k / 2 <= i && !removed(k / 2, k % 2);
+                __expect(sleepers[k].woken, woken);
+                __expect(nodes[k].pending(), k / 2 > i && !removed(k / 2, k % 2));
+            }
+        }
+
+        for (uint32 i = 0; i < __test_key_count; i++) {
+            __expect(q.wake_up(key(i)), 0u);
+            __expect(q.remove(&nodes[i * 2]), false);
+        }
+        return true;
+    }
+
+    void print() override {}
+
+}; // class test_keyed_wait_queue
+
+} // namespace utils
+
+} // namespace test
+
+#endif
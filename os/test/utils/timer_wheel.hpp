@@ -0,0 +1,85 @@
+#ifndef TEST_UTILS_TIMER_WHEEL_HPP
+#define TEST_UTILS_TIMER_WHEEL_HPP
+
+#include <test/test.h>
+
+#include <utils/timer_wheel.h>
+#include <arch/riscv.h>
+
+namespace test {
+
+namespace utils {
+
+// too large for a kernel stack
+static timer_wheel __test_wheel;
+
+// drives a wheel of its own with made up times: timers fire once, not
+// before their deadline and at most a granule after it, also when they
+// are cascaded down from upper levels. cancelled ones never fire, and
+// those beyond the top level wait and can be cancelled.
+class test_timer_wheel : public test_base {
+    struct counter : sleepable {
+        uint32 woken = 0;
+        void sleep() override {}
+        void wake_up() override { woken++; }
+    };
+
+    static constexpr uint64 G = 1ul << timer_wheel::GRANULE_SHIFT;
+    static constexpr int COUNT = 5;
+
+public:
+    bool run() override {
+        timer_wheel& w = __test_wheel;
+        uint64 base = r_time();
+        // level 0, level 1, two cascades, three cascades, then a cancelled one
+        uint64 delay[COUNT] = {3 * G, 100 * G, 5000 * G, 300000 * G, 50 * G};
+        counter sleepers[COUNT];
+        timer_wheel::node nodes[COUNT];
+        for (int i = 0; i < COUNT; i++) {
+            nodes[i].sleeper = &sleepers[i];
+            w.add(&nodes[i], base + delay[i]);
+        }
+        // beyond the top level, it goes around again
+        uint64 far = base + (G << (timer_wheel::SLOT_BITS * timer_wheel::LEVEL_COUNT)) + 5 * G;
+        counter far_sleeper;
+        timer_wheel::node far_node;
+        far_node.sleeper = &far_sleeper;
+        w.add(&far_node, far);
+        __expect(w.size(), (uint32)(COUNT + 1));
+        __expect(w.next_expiry() <= base + delay[0] + G, true);
+
+        __expect(timer_wheel::cancel(&nodes[4]), true);
+        __expect(timer_wheel::cancel(&nodes[4]), false);
+        __expect(nodes[4].pending(), false);
+
+        for (int i = 0; i < COUNT - 1; i++) {
+            w.advance(base + delay[i] - 1);
+            __expect(sleepers[i].woken, 0u);
+            w.advance(base + delay[i] + G);
+            __expect(sleepers[i].woken, 1u);
+            __expect(nodes[i].pending(), false);
+            __expect(timer_wheel::cancel(&nodes[i]), false);
+        }
+        w.advance(base + delay[3] + 64 * G);
+        for (int i = 0; i < COUNT; i++) {
+            __expect(sleepers[i].woken, (uint32)(i < COUNT - 1));
+        }
+
+        __expect(far_sleeper.woken, 0u);
+        __expect(w.size(), 1u);
+        __expect(w.next_expiry() <= far, true);
+        __expect(timer_wheel::cancel(&far_node), true);
+        __expect(w.size(), 0u);
+        __expect(w.next_expiry(), ~0ul);
+        return true;
+    }
+
+    void print() override {}
+
+}; // class test_timer_wheel
+
+} // namespace utils
+
+} // namespace test
+
+#endif
@@ -26,39 +26,38 @@ struct data_t {
     int value;
 };
 data_t test_walker_arr[9] = {{1, 1}, {2, 2}, {3, 3}, {0, 4}, {6, 5}, {4, 6}, {4, 7}, {4, 8}, {4, 9}};
-task<int> test_walker(int lo, int hi) {
+generator<int> test_walker(int lo, int hi) {
     for (int i = 0; i < 9; i++) {
         int index = test_walker_arr[i].index;
         if (index >= lo && index < hi) {
             co_yield test_walker_arr[i].value;
         }
     }
-    co_return 0;
 }
 
 task<int> test_coroutine4_1(int*) noexcept {
     co_infof("test_coroutine4.1: start"); 
     auto walker = test_walker(2, 5);
-    co_infof("test_coroutine4.1: create test_walker:%p", walker.get_promise()); 
+    co_infof("test_coroutine4.1: create test_walker"); 
 
     int found = 0;
-    while (true) {
-        std::optional<int> value = co_await walker;
-
-        if (*value == 0) {
-            co_infof("test_coroutine4.1: walker done");
-            break;
-        }
-        found+=*value;
-        co_infof("test_coroutine4.1: walker value:%d",*value);
-
-        // value = walker.promise().result;
+    for (int value : walker) {
+        found+=value;
+        co_infof("test_coroutine4.1: walker value:%d",value);
 
         //printf("test_coroutine4: try to schedule out\n");
         // co_await kernel_scheduler.next_schedule;
         co_await this_scheduler;
     }
+    co_infof("test_coroutine4.1: walker done");
 
+    // the same generator type consumed asynchronously
+    auto walker2 = test_walker(0, 2);
+    int found2 = 0;
+    while (auto value = co_await walker2) {
+        found2+=*value;
+    }
+    kernel_assert(found2 == 5, "test_coroutine4.1: walker2 should yield 1 and 4");
 
     co_return found;
 }
@@ -320,6 +319,101 @@ task<void> test_coroutine_kill(int* ref){
     co_return task_ok;
 }
 
+task<int> test_when_all_child(int x) {
+    co_await this_scheduler;
+    co_return x * 2;
+}
+
+task<int> test_when_all_fail_child() {
+    co_await this_scheduler;
+    co_return task_fail;
+}
+
+task<void> test_when_all(int* ref) {
+    auto [a, b] = co_await when_all(test_when_all_child(1), test_when_all_child(2));
+    *ref += *a + *b;
+
+    std::vector<task<int>> tasks;
+    for (int i = 0; i < 4; i++) {
+        tasks.push_back(test_when_all_child(i));
+    }
+    auto results = co_await when_all(std::move(tasks));
+    for (auto& r : results) {
+        *ref += *r;
+    }
+
+    auto [index, value] = co_await when_any(test_when_all_fail_child(), test_when_all_child(5));
+    kernel_assert(index == 1, "test_when_all: when_any should return the second task");
+    *ref += *value;
+
+    co_return task_ok;
+}
+
+task<void> test_when_all_fail(int* ref) {
+    co_await when_all(test_when_all_child(1), test_when_all_fail_child());
+    co_errorf("test_when_all_fail: this should not be printed");
+    (*ref)++;
+    co_return task_ok;
+}
+
+// the failure ends at the detached root, it is destroyed once with t in it
+task<void> test_when_all_fail_root(int* ref) {
+    test_coroutine_kill_struct t(ref);
+    co_await when_all(test_when_all_fail_child(), test_when_all_child(2));
+    co_errorf("test_when_all_fail_root: this should not be printed");
+    (*ref) += 100;
+    co_return task_ok;
+}
+
+// critical work goes ahead of normal work queued before it, and so does a
+// task woken by wake_up_critical, which is normal again once it runs
+int test_priority_seq = 0;
+single_wait_queue test_priority_wq;
+spinlock test_priority_lock;
+
+task<void> test_priority_mark(int* order) {
+    *order = test_priority_seq++;
+    co_return task_ok;
+}
+
+task<void> test_priority_waiter(int* order, bool* normal_after) {
+    test_priority_lock.lock();
+    co_await test_priority_wq.done(test_priority_lock);
+    test_priority_lock.unlock();
+    *order = test_priority_seq++;
+    task_base self = co_await get_taskbase_t{};
+    *normal_after = self.get_promise()->priority == task_priority::normal;
+    co_return task_ok;
+}
+
+task<void> test_priority_waker(int* order) {
+    task_base self = co_await get_taskbase_t{};
+    self.get_promise()->self_scheduler->schedule(test_priority_mark(order));
+    test_priority_lock.lock();
+    test_priority_wq.wake_up_critical();
+    test_priority_lock.unlock();
+    co_return task_ok;
+}
+
+task<int> test_arena_leaf(int x) {
+    co_await this_scheduler;
+    co_return x + 1;
+}
+
+task<int> test_arena_mid(int x) {
+    int a = *co_await test_arena_leaf(x);
+    int b = *co_await test_arena_leaf(x);
+    co_return a + b;
+}
+
+// frames of the whole chain come from the root's arena and are reused every round
+task<void> test_arena(int* ref) {
+    for (int i = 0; i < 100; i++) {
+        *ref += *co_await test_arena_mid(i);
+    }
+    co_return task_ok;
+}
+
 // extern task_scheduler kernel_task_scheduler[NCPU];
 task_scheduler test_scheduler;
 task_queue test_queue;
@@ -356,6 +450,21 @@ int kernel_coroutine_test() {
     int test_coroutine_kill_ref = 0;
     auto test_coroutine_kill_task = test_coroutine_kill(&test_coroutine_kill_ref);
 
+    int test_when_all_ref = 0;
+    auto test_when_all_task = test_when_all(&test_when_all_ref);
+    auto test_when_all_fail_task = test_when_all_fail(&test_when_all_ref);
+    int test_when_all_fail_root_ref = 0;
+    auto test_when_all_fail_root_task = test_when_all_fail_root(&test_when_all_fail_root_ref);
+
+    int test_priority_order[6] = {};
+    bool test_priority_normal_after = false;
+    auto test_priority_waiter_task = test_priority_waiter(&test_priority_order[4], &test_priority_normal_after);
+    auto test_priority_waker_task = test_priority_waker(&test_priority_order[5]);
+
+    int test_arena_ref = 0;
+    auto test_arena_task = test_arena(&test_arena_ref);
+    test_arena_task.use_frame_arena();
+
     test_scheduler.set_queue(&test_queue);
 
 
@@ -372,6 +481,17 @@ int kernel_coroutine_test() {
     test_scheduler.schedule(std::move(h5));
 
     test_scheduler.schedule(std::move(test_coroutine_kill_task));
+    test_scheduler.schedule(std::move(test_when_all_task));
+    test_scheduler.schedule(std::move(test_when_all_fail_task));
+    test_scheduler.schedule(std::move(test_when_all_fail_root_task));
+    test_scheduler.schedule(std::move(test_arena_task));
+
+    for (int i = 0; i < 3; i++) {
+        test_scheduler.schedule(test_priority_mark(&test_priority_order[i]));
+    }
+    test_scheduler.schedule(test_priority_mark(&test_priority_order[3]), task_priority::critical);
+    test_scheduler.schedule(std::move(test_priority_waiter_task));
+    test_scheduler.schedule(std::move(test_priority_waker_task));
 
 
     test_normal_generator(1000000);
@@ -383,6 +503,12 @@ int kernel_coroutine_test() {
     kernel_console_logger.printf("main: test: %d\n", test);
     kernel_assert(test==39, "test should be 3+1+35");
     kernel_assert(test_coroutine_kill_ref==2, "test_coroutine_kill_ref should be 2");
+    kernel_assert(test_when_all_ref==28, "test_when_all_ref should be 6+12+10");
+    kernel_assert(test_when_all_fail_root_ref==1, "test_when_all_fail_root_ref should be 1");
+    kernel_assert(test_arena_ref==10100, "test_arena_ref should be 2*(1+...+100)");
+    kernel_assert(test_priority_order[3] == 0, "critical task should run before normal ones");
+    kernel_assert(test_priority_order[4] < test_priority_order[5], "task woken critical should run before normal ones");
+    kernel_assert(test_priority_normal_after, "woken critical task should be normal again");
 
     debugf("kernel_coroutine_test: end");
     return test;
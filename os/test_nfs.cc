@@ -79,7 +79,8 @@ task<void> test_nfs2_coro(device_id_t device_id) {
                 auto dir_iterator = root->get_inode()->read_dir();
 
                 int count = 0;
-                while (auto dentry = *co_await dir_iterator) {
+                while (auto next = co_await dir_iterator) {
+                    auto& dentry = *next;
                     debugf("test_nfs_coro: read dir: %s %d", dentry->name.data(),
                            dentry->get_inode()->inode_number);
                     count++;
@@ -260,7 +261,8 @@ task<void> test_nfs_coro_unit(device_id_t device_id) {
             auto dir_iterator = dir_inode->read_dir();
 
             int count = 0;
-            while (auto dentry = *co_await dir_iterator) {
+            while (auto next = co_await dir_iterator) {
+                auto& dentry = *next;
                 auto inode = dentry->get_inode();
                 debugf("test_nfs_coro: read dir: %s %d", dentry->name.data(),
                        inode->inode_number);
@@ -275,7 +277,8 @@ task<void> test_nfs_coro_unit(device_id_t device_id) {
             auto dir_iterator = dir_inode->read_dir();
 
             int count = 0;
-            while (auto dentry = *co_await dir_iterator) {
+            while (auto next = co_await dir_iterator) {
+                auto& dentry = *next;
                 auto inode = dentry->get_inode();
                 debugf("test_nfs_coro: read dir2: %s %d", dentry->name.data(),
                        inode->inode_number);
@@ -298,7 +301,8 @@ task<void> test_nfs_coro_unit(device_id_t device_id) {
             auto dir_iterator = dir_inode->read_dir();
 
             int count = 0;
-            while (auto dentry = *co_await dir_iterator) {
+            while (auto next = co_await dir_iterator) {
+                auto& dentry = *next;
                 auto inode = dentry->get_inode();
                 debugf("test_nfs_coro: read dir: %s %d", dentry->name.data(),
                        inode->inode_number);
@@ -344,7 +348,8 @@ task<void> test_nfs_coro_unit(device_id_t device_id) {
             auto dir_iterator = dir_inode->read_dir();
  
             int count = 0;
-            while (auto dentry = *co_await dir_iterator) {
+            while (auto next = co_await dir_iterator) {
+                auto& dentry = *next;
                 auto inode = dentry->get_inode();
                 debugf("test_nfs_coro: read dir: %s %d", dentry->name.data(),
                        inode->inode_number);
@@ -511,7 +516,8 @@ task<void> __test_nfs_coro(device_id_t device_id) {
         auto dir_iterator = dir_inode->read_dir();
 
         int count = 0;
-        while (auto dentry = *co_await dir_iterator) {
+        while (auto next = co_await dir_iterator) {
+            auto& dentry = *next;
             debugf("test_nfs_coro: read dir: %s %d", dentry->name.data(),
                    dentry->get_inode()->inode_number);
             count++;
@@ -532,7 +538,8 @@ task<void> __test_nfs_coro(device_id_t device_id) {
         auto dir_iterator = dir_inode->read_dir();
 
         int count = 0;
-        while (auto dentry = *co_await dir_iterator) {
+        while (auto next = co_await dir_iterator) {
+            auto& dentry = *next;
             debugf("test_nfs_coro: read dir: %s %d", dentry->name.data(),
                    dentry->get_inode()->inode_number);
             count++;
@@ -576,7 +583,8 @@ task<void> __test_nfs_coro(device_id_t device_id) {
         auto dir_iterator = dir_inode->read_dir();
 
         int count = 0;
-        while (auto dentry = *co_await dir_iterator) {
+        while (auto next = co_await dir_iterator) {
+            auto& dentry = *next;
             debugf("test_nfs_coro: read dir: %s %d", dentry->name.data(),
                    dentry->get_inode()->inode_number);
             count++;
@@ -609,7 +617,9 @@ void test_nfs2(void*) {
     // kernel_task_queue.push(test_nfs_coro(virtio_disk_id));
 
     // kernel_task_scheduler[0].schedule(std::move(test_coro(&a)));
-    kernel_task_scheduler[0].schedule(std::move(test_nfs_coro(virtio_disk_id)));
+    auto t = test_nfs_coro(virtio_disk_id);
+    t.use_frame_arena();
+    kernel_task_scheduler[0].schedule(std::move(t));
 
     infof("test_nfs: push ok");
 }
\ No newline at end of file
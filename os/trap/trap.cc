@@ -3,6 +3,7 @@
 #include <ccore/types.h>
 
 #include <proc/process.h>
+#include <proc/scheduler.h>
 
 #include <utils/log.h>
 #include <utils/assert.h>
@@ -55,12 +56,25 @@ void kernel_interrupt_handler(uint64 scause, uint64 stval, uint64 sepc) {
 
     switch (cause) {
     case SupervisorTimer: // kernel process timer, switch to next_context (scheduler)
-        
+        c->wake_up(); // expired sleepers
+        if (!c->slice_expired()) { // only a sleeper deadline, keep running
+            c->program_timer();
+            break;
+        }
+        if (kernel_process_scheduler[c->get_core_id()].preempt()) {
+            break;
+        }
         p = c->get_kernel_process();
         //debug_core("kernel timer interrupt: schedule %s out", p->get_name());
         c->switch_back(p->get_context());
         //debug_core("kernel timer interrupt: schedule %s in", p->get_name());
         break;
+    case SupervisorSoft: // ipi, someone wakes us up from wfi
+        w_sip(r_sip() & ~SIP_SSIP);
+        if (c->slice_expired()) { // ended by a fifo wake up, the timer takes it from here
+            c->program_timer();
+        }
+        break;
     case SupervisorExternal:
         interrupt_handler();
         break;
@@ -150,6 +164,8 @@ extern "C" void kernel_trap(uint64 sp, uint64 fp) {
 
     if (scause & (1ULL << 63)) { 
         kernel_interrupt_handler(scause, stval, sepc);
+    } else if ((scause & 0xff) == IllegalInstruction && timer::fixup_probe(sepc)) {
+        sepc += 4; // no Sstc, skip the probing csrr
     } else {
         kernel_exception_handler(scause, stval, sepc, sp, fp);
     } 
@@ -175,8 +191,18 @@ void user_interrupt_handler(uint64 scause, uint64 stval, uint64 sepc) {
 
     switch (scause & 0xff) {
     case SupervisorTimer:
+        cpu::__my_cpu()->wake_up(); // expired sleepers
+        if (!cpu::__my_cpu()->slice_expired()) { // only a sleeper deadline, back to user
+            break;
+        }
         cpu::__my_cpu()->switch_back(nullptr); // we don't save context, because stack is shared with other processes
         break;
+    case SupervisorSoft:
+        w_sip(r_sip() & ~SIP_SSIP);
+        if (cpu::__my_cpu()->slice_expired()) { // ended by a fifo wake up
+            cpu::__my_cpu()->program_timer();
+        }
+        break;
     case SupervisorExternal:
         interrupt_handler();
         break;
@@ -306,7 +332,7 @@ void user_trap_ret() {
     w_sstatus(x);
 
     w_sie(r_sie() | SIE_STIE | SIE_SSIE | SIE_SEIE); // enable all interrupts in user mode
-    timer::set_next_timer();
+    c->program_timer();
 
     // tell trampoline.S the user page table to switch to.
     uint64 satp = MAKE_SATP(p->get_pagetable());
@@ -171,14 +171,26 @@ public:
         return _valid;
     }
 
-    task<reference_guard<derived_type>> get_ref() {
-        co_await get();
-        co_return reference_guard<derived_type>{&__get_derived()};
+    // loaded and not in use: take it without a coroutine frame
+    ready_task<reference_guard<derived_type>> get_ref() {
+        if (_in_use_mutex.try_lock()) {
+            if (_valid) {
+                return ready_task<reference_guard<derived_type>>::done(
+                    reference_guard<derived_type>{&__get_derived()});
+            }
+            _in_use_mutex.unlock();
+        }
+        return __get_ref();
     }
     
 
     private:
 
+    task<reference_guard<derived_type>> __get_ref() {
+        co_await get();
+        co_return reference_guard<derived_type>{&__get_derived()};
+    }
+
     coro_mutex _in_use_mutex {"bufferable.in_use_mutex"};
     
     bool _valid = false;
@@ -4,6 +4,7 @@
 
 #include "buffer.h"
 #include <utils/shared_ptr.h>
+#include <utils/wait_queue.h>
 
 #include <utils/log.h>
 
@@ -12,13 +13,16 @@ class buffer_manager {
     
 public:
 
+    static constexpr uint32 FLUSH_BATCH = 32;
+
     using buffer_ref_t = reference_guard<buffer_t>;
     using buffer_ptr_t = shared_ptr<buffer_t>;
 
     list<buffer_ptr_t> buffer_list;
 
     list<buffer_ptr_t> flush_list;
-    wait_queue flush_queue;
+    // keyed by the node being flushed, so a flush only wakes its own waiters
+    keyed_wait_queue flush_queue;
 
     spinlock lock {"buffer_manager.lock"};
 
@@ -36,28 +40,15 @@ public:
 
         // if what we require is in flush list, wait for it finish
         {
-            bool in_flush = false;
-            do {
-                in_flush = false;
-                for (auto& node : flush_list) {
-                    if (node->match(std::forward<Args>(match_args)...)) {
-                    
-                        in_flush = true;
-                        // debugf("block_buffer: wait flush %d", block_no);
-                        co_await flush_queue.done(lock);
-                        break;
-                    }
-                }
-            } while(in_flush);
+            while (buffer_t* node = __in_flush(match_args...)) {
+                // debugf("block_buffer: wait flush %d", block_no);
+                co_await flush_queue.done(keyed_wait_queue::make_key(node), lock);
+            }
         }
 
-
-
-        for(auto it = buffer_list.begin(); it != buffer_list.end(); ++it) {
-            auto& node = *it;
-            if(node->match(std::forward<Args>(match_args)...)) {
-                // put node at the front of the list
-                buffer_list.move_to_front(it);
+        {
+            buffer_ptr_t node = __find(match_args...);
+            if (node) {
                 lock.unlock();
                 co_return node;
             }
@@ -117,7 +108,7 @@ public:
         lock.lock();
         flush_list.erase(flush_it);
 
-        flush_queue.wake_up_all();
+        flush_queue.wake_up(keyed_wait_queue::make_key(buf.get()));
 
         // TODO: performance
         // merge it back is dangerous, because someone may added it too
@@ -146,9 +137,20 @@ public:
         co_return ret_buf;
     }
 
+    // a cached node not being flushed is returned without a coroutine frame
     template <typename... Args>
-    task<buffer_ptr_t> get(Args&&... match_args) {
-        co_return *co_await get_derived<buffer_t>(std::forward<Args>(match_args)...);
+    ready_task<buffer_ptr_t> get(Args&&... match_args) {
+        buffer_ptr_t node;
+        lock.lock();
+        if (!__in_flush(match_args...)) {
+            node = __find(match_args...);
+        }
+        lock.unlock();
+
+        if (node) {
+            return ready_task<buffer_ptr_t>::done(std::move(node));
+        }
+        return get_derived<buffer_t>(std::forward<Args>(match_args)...);
     }
 
     // TODO: Note: destroy makes size not that correct
@@ -179,11 +181,26 @@ public:
         }
         lock.unlock();
 
-        for(auto& node : flush_list) {
-            
-            // debugf("buffer_manager: flush %p", node.get());
-            co_await node->flush();
-            node->init(); // init to null
+        // flush them in parallel, FLUSH_BATCH at a time
+        std::vector<task<void>> flush_tasks;
+        flush_tasks.reserve(FLUSH_BATCH);
+        auto batch_begin = flush_list.begin();
+        for (auto it = flush_list.begin(); it != flush_list.end();) {
+            // debugf("buffer_manager: flush %p", (*it).get());
+            // writeback should not delay foreground reads
+            auto flush_task = (*it)->flush();
+            flush_task.set_priority(task_priority::background);
+            flush_tasks.push_back(std::move(flush_task));
+            ++it;
+
+            if (flush_tasks.size() == FLUSH_BATCH || it == flush_list.end()) {
+                co_await when_all(std::move(flush_tasks));
+                flush_tasks.clear();
+
+                for (; batch_begin != it; ++batch_begin) {
+                    (*batch_begin)->init(); // init to null
+                }
+            }
         }
 
         // add it back to buffer_list
@@ -205,6 +222,31 @@ public:
         }
     }
 
+private:
+    // lock should be held, return the matching node being flushed
+    template <typename... Args>
+    buffer_t* __in_flush(Args&... match_args) {
+        for (auto& node : flush_list) {
+            if (node->match(match_args...)) {
+                return node.get();
+            }
+        }
+        return nullptr;
+    }
+
+    // lock should be held, found node is moved to the front
+    template <typename... Args>
+    buffer_ptr_t __find(Args&... match_args) {
+        for(auto it = buffer_list.begin(); it != buffer_list.end(); ++it) {
+            if((*it)->match(match_args...)) {
+                buffer_ptr_t node = *it;
+                buffer_list.move_to_front(it);
+                return node;
+            }
+        }
+        return nullptr;
+    }
+
 };
 
 
@@ -5,6 +5,9 @@ class sleepable {
     public:
     virtual void sleep() = 0;
     virtual void wake_up() = 0;
+    // wake up for the completion of urgent work, e.g. I/O. a task runs its
+    // next round as critical, others just wake up
+    virtual void wake_up_critical() { wake_up(); }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,58 @@
+#include "task_trace.h"
+
+#include <arch/timer.h>
+#include <utils/log.h>
+
+task_tracer kernel_task_tracer;
+
+static const char* event_name(task_event event) {
+    switch (event) {
+    case task_event::create:   return "create";
+    case task_event::resume:   return "resume";
+    case task_event::suspend:  return "suspend";
+    case task_event::wake:     return "wake";
+    case task_event::complete: return "complete";
+    case task_event::fail:     return "fail";
+    }
+    return "unknown";
+}
+
+void task_tracer::clear() {
+    for (auto& ring : rings) {
+        __atomic_store_n(&ring.head, 0, __ATOMIC_RELAXED);
+    }
+}
+
+// resume and suspend make a slice on the core's track, others are instant events
+void task_tracer::dump() {
+    bool was_enabled = is_enabled();
+    disable();
+
+    _rawf("{\"traceEvents\":[\n");
+    bool first = true;
+    for (int cpu = 0; cpu < NCPU; cpu++) {
+        cpu_ring& ring = rings[cpu];
+        uint64 head = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+        uint64 start = head > RING_SIZE ? head - RING_SIZE : 0;
+
+        for (uint64 i = start; i < head; i++) {
+            entry& e = ring.entries[i & (RING_SIZE - 1)];
+            const char* ph = "i";
+            if (e.event == task_event::resume) {
+                ph = "B";
+            } else if (e.event == task_event::suspend) {
+                ph = "E";
+            }
+
+            _rawf("%s{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%l,\"pid\":0,\"tid\":%d,\"s\":\"t\",\"args\":{\"promise\":\"%p\"}}",
+                  first ? "" : ",\n", event_name(e.event), ph,
+                  (int64)timer::TICK_TO_US(e.time), cpu, (uint64)e.promise);
+            first = false;
+        }
+    }
+    _rawf("\n]}\n");
+
+    if (was_enabled) {
+        enable();
+    }
+}
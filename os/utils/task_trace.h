@@ -0,0 +1,64 @@
+// per-cpu ring of coroutine events, dumped as chrome trace json
+#ifndef UTILS_TASK_TRACE_H
+#define UTILS_TASK_TRACE_H
+
+#include <ccore/types.h>
+#include <arch/config.h>
+#include <arch/riscv.h>
+
+enum class task_event : uint8 { create, resume, suspend, wake, complete, fail };
+
+// always compiled in, but records nothing until enabled.
+// each core appends to its own ring, the slot is claimed by an atomic add
+// on the ring head, so interrupts on the same core cannot tear an entry
+// and no lock is taken. old entries are overwritten when the ring is full.
+class task_tracer {
+   public:
+    static constexpr uint32 RING_SIZE = 2048; // power of two
+
+    struct entry {
+        uint64 time; // r_time()
+        const void* promise;
+        task_event event;
+    };
+
+    void record(task_event event, const void* promise) {
+        if (!__atomic_load_n(&enabled, __ATOMIC_RELAXED)) {
+            return;
+        }
+        cpu_ring& ring = rings[r_tp()];
+        uint64 i = __atomic_fetch_add(&ring.head, 1, __ATOMIC_RELAXED);
+        entry& e = ring.entries[i & (RING_SIZE - 1)];
+        e.time = r_time();
+        e.promise = promise;
+        e.event = event;
+    }
+
+    void enable() { __atomic_store_n(&enabled, true, __ATOMIC_RELEASE); }
+    void disable() { __atomic_store_n(&enabled, false, __ATOMIC_RELEASE); }
+    bool is_enabled() const { return __atomic_load_n(&enabled, __ATOMIC_RELAXED); }
+
+    // drop all recorded events, call it with tracing disabled
+    void clear();
+
+    // print all rings to console in chrome/perfetto trace event format,
+    // tracing is disabled while dumping
+    void dump();
+
+   private:
+    struct __attribute__((aligned(64))) cpu_ring {
+        uint64 head = 0;
+        entry entries[RING_SIZE] {};
+    };
+
+    bool enabled = false;
+    cpu_ring rings[NCPU];
+};
+
+extern task_tracer kernel_task_tracer;
+
+static inline void task_trace(task_event event, const void* promise) {
+    kernel_task_tracer.record(event, promise);
+}
+
+#endif // UTILS_TASK_TRACE_H
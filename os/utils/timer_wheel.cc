@@ -0,0 +1,158 @@
+#include "timer_wheel.h"
+
+#include <atomic/lock.h>
+#include <arch/riscv.h>
+
+void timer_wheel::add(node* n, uint64 expire_tick) {
+    auto guard = make_lock_guard(lock);
+    uint64 expire = (expire_tick + (1ul << GRANULE_SHIFT) - 1) >> GRANULE_SHIFT;
+    if (count == 0) {
+        // nothing to cascade, skip the idle granules at once
+        uint64 now = r_time() >> GRANULE_SHIFT;
+        if (now > current) {
+            current = now;
+        }
+    }
+    n->expire = expire < current ? current : expire;
+    __insert(n);
+    __atomic_store_n(&n->wheel, this, __ATOMIC_RELEASE);
+    count++;
+}
+
+bool timer_wheel::cancel(node* n) {
+    timer_wheel* wheel = __atomic_load_n(&n->wheel, __ATOMIC_ACQUIRE);
+    if (!wheel) {
+        return false;
+    }
+    auto guard = make_lock_guard(wheel->lock);
+    if (n->wheel != wheel) { // fired meanwhile
+        return false;
+    }
+    wheel->__unlink(n);
+    __atomic_store_n(&n->wheel, nullptr, __ATOMIC_RELEASE);
+    wheel->count--;
+    return true;
+}
+
+uint32 timer_wheel::advance(uint64 now_tick) {
+    uint64 now = now_tick >> GRANULE_SHIFT;
+    uint32 fired = 0;
+
+    auto guard = make_lock_guard(lock);
+    while (current <= now) {
+        if (count == 0) {
+            current = now + 1;
+            break;
+        }
+
+        // cascade the level above when the one below wraps
+        for (uint32 level = 1; level < LEVEL_COUNT; level++) {
+            if ((current >> (SLOT_BITS * (level - 1))) & (SLOT_COUNT - 1)) {
+                break;
+            }
+            __cascade(level);
+        }
+
+        uint32 index = current & (SLOT_COUNT - 1);
+        link* head = &slots[0][index];
+        link* l = head->next;
+        head->next = head->prev = head;
+        occupied[0] &= ~(1ul << index);
+        while (l != head) {
+            node* n = static_cast<node*>(l);
+            l = l->next;
+            if (n->expire > current) { // beyond the top level, go around again
+                __insert(n);
+                continue;
+            }
+            __atomic_store_n(&n->wheel, nullptr, __ATOMIC_RELEASE);
+            count--;
+            fired++;
+            // n is in the frame or stack of the sleeper, do not touch it after wake up
+            n->sleeper->wake_up();
+        }
+        current++;
+
+        // nothing left before the next cascade, skip the empty slots
+        index = current & (SLOT_COUNT - 1);
+        if (index && !(occupied[0] >> index)) {
+            uint64 next = (current | (SLOT_COUNT - 1)) + 1;
+            current = next < now + 1 ? next : now + 1;
+        }
+    }
+    return fired;
+}
+
+uint64 timer_wheel::next_expiry() {
+    auto guard = make_lock_guard(lock);
+    if (count == 0) {
+        return ~0ul;
+    }
+
+    uint64 earliest = ~0ul;
+    for (uint32 level = 0; level < LEVEL_COUNT; level++) {
+        uint64 bits = occupied[level];
+        if (!bits) {
+            continue;
+        }
+        // the current slot of an upper level has been cascaded already,
+        // unless we stand right on its boundary
+        uint64 shift = SLOT_BITS * level;
+        uint64 block = (current >> shift) + ((current & ((1ul << shift) - 1)) ? 1 : 0);
+        uint32 from = block & (SLOT_COUNT - 1);
+        uint64 rotated = from ? (bits >> from) | (bits << (SLOT_COUNT - from)) : bits;
+        uint64 start = (block + __builtin_ctzl(rotated)) << shift;
+        if (start < earliest) {
+            earliest = start;
+        }
+    }
+    return earliest << GRANULE_SHIFT;
+}
+
+void timer_wheel::__insert(node* n) {
+    uint64 delta = n->expire - current;
+    uint64 expire = n->expire;
+    uint32 level = 0;
+    while (level < LEVEL_COUNT - 1 && delta >= (1ul << (SLOT_BITS * (level + 1)))) {
+        level++;
+    }
+    if (delta >= (1ul << (SLOT_BITS * LEVEL_COUNT))) {
+        expire = current + (1ul << (SLOT_BITS * LEVEL_COUNT)) - 1;
+    }
+
+    uint32 index = (expire >> (SLOT_BITS * level)) & (SLOT_COUNT - 1);
+    link* head = &slots[level][index];
+    occupied[level] |= 1ul << index;
+    n->prev = head->prev;
+    n->next = head;
+    head->prev->next = n;
+    head->prev = n;
+}
+
+void timer_wheel::__unlink(node* n) {
+    link* prev = n->prev;
+    n->prev->next = n->next;
+    n->next->prev = n->prev;
+    n->next = n->prev = n;
+
+    // the last one of the slot, prev is the sentinel
+    if (prev->next == prev) {
+        uint64 offset = (link*)prev - &slots[0][0];
+        if (offset < LEVEL_COUNT * SLOT_COUNT) {
+            occupied[offset / SLOT_COUNT] &= ~(1ul << (offset % SLOT_COUNT));
+        }
+    }
+}
+
+void timer_wheel::__cascade(uint32 level) {
+    uint32 index = (current >> (SLOT_BITS * level)) & (SLOT_COUNT - 1);
+    link* head = &slots[level][index];
+    link* l = head->next;
+    head->next = head->prev = head;
+    occupied[level] &= ~(1ul << index);
+    while (l != head) {
+        node* n = static_cast<node*>(l);
+        l = l->next;
+        __insert(n);
+    }
+}
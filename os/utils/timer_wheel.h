@@ -0,0 +1,70 @@
+// per-cpu hierarchical timing wheel for sleeps
+#ifndef UTILS_TIMER_WHEEL_H
+#define UTILS_TIMER_WHEEL_H
+
+#include <ccore/types.h>
+#include <atomic/spinlock.h>
+#include <utils/sleepable.h>
+
+// time is cut into granules of 2^GRANULE_SHIFT ticks (~82 us). level l has
+// 64 slots of 64^l granules each, a timer goes to the lowest level that can
+// hold its delay, so insert and cancel are O(1). when level 0 wraps, the
+// current slot of the level above is cascaded down. timers never fire early,
+// the expiry is rounded up to a granule. a bitmap of occupied slots per
+// level gives the next deadline for programming the timer, and lets advance
+// skip empty slots after a long idle.
+// the nodes live in the sleeper (coroutine frame or kernel stack), nothing
+// is allocated. the wheel is advanced on its own core with irqs off, but a
+// sleeper may cancel from any core (tasks are stolen), hence the lock.
+class timer_wheel {
+   public:
+    static constexpr uint32 GRANULE_SHIFT = 10;
+    static constexpr uint32 SLOT_BITS = 6;
+    static constexpr uint32 SLOT_COUNT = 1 << SLOT_BITS;
+    static constexpr uint32 LEVEL_COUNT = 5; // ~1 day, longer ones wrap around
+
+    struct link {
+        link* next = this;
+        link* prev = this;
+    };
+
+    struct node : link {
+        uint64 expire = 0; // in granules
+        sleepable* sleeper = nullptr;
+        timer_wheel* wheel = nullptr; // non-null while pending
+
+        bool pending() const {
+            return __atomic_load_n(&wheel, __ATOMIC_ACQUIRE) != nullptr;
+        }
+    };
+
+    // wake up n->sleeper at r_time() >= expire_tick
+    void add(node* n, uint64 expire_tick);
+    // return false if it has fired or was never added
+    static bool cancel(node* n);
+
+    // fire all timers due at now_tick, return the count
+    uint32 advance(uint64 now_tick);
+
+    // tick of the earliest timer, or ~0 if none. it may be earlier than the
+    // timer itself when that one still sits in an upper level, advancing
+    // at that tick cascades it down.
+    uint64 next_expiry();
+
+    uint32 size() const {
+        return count;
+    }
+
+   private:
+    void __insert(node* n);
+    void __unlink(node* n);
+    void __cascade(uint32 level);
+
+    spinlock lock {"timer_wheel.lock"};
+    link slots[LEVEL_COUNT][SLOT_COUNT]; // circular lists, the slot is the sentinel
+    uint64 occupied[LEVEL_COUNT] = {};   // bit i set if slot i may be non-empty
+    uint64 current = 0; // next granule to process
+    uint32 count = 0;
+};
+
+#endif // UTILS_TIMER_WHEEL_H
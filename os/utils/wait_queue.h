@@ -111,6 +111,13 @@ class single_wait_queue : public wait_queue_base {
         }
     }
 
+    void wake_up_critical() {
+        if (sleeper) {
+            sleeper->wake_up_critical();
+            sleeper = nullptr;
+        }
+    }
+
     int32 size() {
         return sleeper ? 1 : 0;
     }
@@ -119,6 +126,167 @@ class single_wait_queue : public wait_queue_base {
 };
 
 
+// waiters sleep on a key, e.g. the address of a buffer being flushed, and
+// wake_up(key) only wakes those. keys are hashed into buckets of intrusive
+// lists, the nodes live in the awaiting coroutine frames, so nothing is
+// allocated. like other wait queues, the caller's lock protects it.
+class keyed_wait_queue {
+    public:
+    static constexpr uint32 BUCKET_COUNT = 64;
+
+    struct node {
+        uint64 key;
+        sleepable* sleeper;
+        node* next = nullptr;
+
+        // in the queue, sleeper is cleared when it is woken or removed
+        bool pending() const { return sleeper != nullptr; }
+    };
+
+    struct keyed_done {
+        keyed_wait_queue* wq;
+        spinlock& lock;
+        task_base caller;
+        node n;
+
+        keyed_done(keyed_wait_queue* wq, uint64 key, spinlock& lock)
+            : wq(wq), lock(lock), n{key, nullptr} {}
+        keyed_done(keyed_done&& other) // before suspending only
+            : wq(other.wq), lock(other.lock), n{other.n.key, nullptr} {}
+        bool await_ready() const {
+            return false;
+        }
+        std::coroutine_handle<> await_suspend(task_base h) {
+            caller = std::move(h);
+
+            if (caller.get_promise()->no_yield) {
+                lock.unlock();
+                return caller.get_handle(); // resume immediately
+            }
+
+            n.sleeper = &caller;
+            wq->sleep(&n);
+
+            lock.unlock();
+
+            // switch back to scheduler
+            return std::noop_coroutine();
+        }
+        void await_resume() {
+            lock.lock();
+        }
+        ~keyed_done() {
+            // the frame is destroyed while waiting
+            if (n.pending()) {
+                lock.lock();
+                wq->remove(&n);
+                lock.unlock();
+            }
+        }
+    };
+
+    keyed_done done(uint64 key, spinlock& lock) {
+        return {this, key, lock};
+    }
+
+    void sleep(node* n) {
+        bucket& b = buckets[__hash(n->key)];
+        n->next = nullptr;
+        if (b.tail) {
+            b.tail->next = n;
+        } else {
+            b.head = n;
+        }
+        b.tail = n;
+        n->sleeper->sleep();
+    }
+
+    // wake up waiters of key, at most max of them in fifo order, return the count
+    uint32 wake_up(uint64 key, uint32 max = ~0u) {
+        bucket& b = buckets[__hash(key)];
+        uint32 count = 0;
+        node* prev = nullptr;
+        node* n = b.head;
+        while (n && count < max) {
+            node* next = n->next;
+            if (n->key == key) {
+                if (prev) {
+                    prev->next = next;
+                } else {
+                    b.head = next;
+                }
+                if (b.tail == n) {
+                    b.tail = prev;
+                }
+                // n is in the frame of the waiter, do not touch it after wake up
+                sleepable* sleeper = n->sleeper;
+                n->sleeper = nullptr;
+                sleeper->wake_up();
+                count++;
+            } else {
+                prev = n;
+            }
+            n = next;
+        }
+        return count;
+    }
+
+    // take n out without waking it, return false if it is not queued
+    bool remove(node* n) {
+        bucket& b = buckets[__hash(n->key)];
+        node* prev = nullptr;
+        for (node* cur = b.head; cur; prev = cur, cur = cur->next) {
+            if (cur != n) {
+                continue;
+            }
+            if (prev) {
+                prev->next = n->next;
+            } else {
+                b.head = n->next;
+            }
+            if (b.tail == n) {
+                b.tail = prev;
+            }
+            n->sleeper = nullptr;
+            return true;
+        }
+        return false;
+    }
+
+    bool wake_up_one(uint64 key) {
+        return wake_up(key, 1) != 0;
+    }
+
+    bool has_waiters(uint64 key) {
+        for (node* n = buckets[__hash(key)].head; n; n = n->next) {
+            if (n->key == key) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static uint64 make_key(const void* ptr) {
+        return (uint64)ptr;
+    }
+    static uint64 make_key(uint64 a, uint64 b) {
+        return a * 0x9E3779B97F4A7C15ul ^ b;
+    }
+
+    private:
+    struct bucket {
+        node* head = nullptr;
+        node* tail = nullptr;
+    };
+    bucket buckets[BUCKET_COUNT];
+
+    static uint32 __hash(uint64 key) {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdul;
+        key ^= key >> 33;
+        return key % BUCKET_COUNT;
+    }
+};
 
 
 #endif
\ No newline at end of file